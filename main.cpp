@@ -1,16 +1,258 @@
 #include "pdf_form_fill.h"
+#include "pdf_form_fill_farm.h"
+#include "pdf_form_data.h"
+
+/**
+ * read one record of a batch file. a record is "field name=value" lines, ended by an empty line or the end of the file.
+ * true/false become booleans, for checkboxes. everything else is a string
+ */
+bool readRecord(FILE* records, std::map<std::string, pdf_form_fill::pdf_value_t>& data) {
+  // whole lines, however long they are
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  bool any = false;
+
+  while((length = getline(&line, &capacity, records)) >= 0) {
+    std::string entry(line, length);
+    while(!entry.empty() && (entry.back() == '\n' || entry.back() == '\r')) {
+      entry.pop_back();
+    }
+
+    if(entry.empty()) {
+      if(any) {
+        break;
+      }
+      continue;
+    }
+
+    size_t separator = entry.find('=');
+    if(separator == std::string::npos) {
+      continue;
+    }
+
+    std::string name = entry.substr(0, separator);
+    std::string value = entry.substr(separator + 1);
+    if(value == "true") {
+      data[name] = true;
+    } else if(value == "false") {
+      data[name] = false;
+    } else {
+      data[name] = value;
+    }
+    any = true;
+  }
+  free(line);
+  return any;
+}
+
+/**
+ * load a template out of its compiled plan, <template>.plan (see --compile), when there's one that matches it. otherwise
+ * parse it
+ */
+bool loadForm(pdf_form_fill& pff, std::unique_ptr<pdf_form_fill::form_template_t>& form, const std::string& path) {
+  form.reset(new pdf_form_fill::form_template_t());
+  if(pff.loadTemplateWithPlan(*form, path, path + ".plan") == eSuccess) {
+    return true;
+  }
+
+  form.reset(new pdf_form_fill::form_template_t());
+  return pff.loadTemplate(*form, path) == eSuccess;
+}
+
+int batch(int argc, char** argv) {
+  pdf_form_fill pff;
+  std::unique_ptr<pdf_form_fill::form_template_t> loaded;
+
+  if(!loadForm(pff, loaded, argv[2])) {
+    printf("failed to load template %s\n", argv[2]);
+    return 1;
+  }
+  const pdf_form_fill::form_template_t& form = *loaded;
+
+  FILE* records = fopen(argv[3], "r");
+  if(records == NULL) {
+    printf("failed to open records %s\n", argv[3]);
+    return 1;
+  }
+
+  // json, ndjson and csv by their extension, anything else is a records file
+  pdf_form_data::format_t format;
+  std::unique_ptr<pdf_form_data> reader;
+  if(pdf_form_data::formatFromPath(argv[3], format)) {
+    reader.reset(new pdf_form_data(records, format, &form));
+  }
+
+  std::string prefix = argv[4];
+  size_t count = 0;
+  std::string bound;
+  EStatusCode status = pff.fillBatch(form, [&](std::map<std::string, pdf_form_fill::pdf_value_t>& data, std::string& outputPath) {
+    if(reader) {
+      if(!reader->next(data)) {
+        return false;
+      }
+      bound = reader->getBindError();
+    } else if(readRecord(records, data)) {
+      bound = pdf_form_data::bind(form, data);
+    } else {
+      return false;
+    }
+    if(!bound.empty()) {
+      printf("%s%zu.pdf: left out %s\n", prefix.c_str(), count, bound.c_str());
+    }
+    outputPath = prefix + std::to_string(count++) + ".pdf";
+    return true;
+  });
+  fclose(records);
+
+  if(reader && !reader->getError().empty()) {
+    printf("failed to read %s: %s\n", argv[3], reader->getError().c_str());
+    return 1;
+  }
+  if(status != eSuccess) {
+    printf("failed to write %s%zu.pdf\n", prefix.c_str(), count - 1);
+    return 1;
+  }
+  printf("wrote %zu documents\n", count);
+  return 0;
+}
+
+/**
+ * fill a list of jobs on a pool of threads. every line of the jobs file is "<template.pdf> <records> <output-prefix>",
+ * and every record in the records file (or .json, .ndjson, .csv) is a job of its own
+ */
+int farm(int argc, char** argv) {
+  pdf_form_fill_farm farm(strtoul(argv[2], NULL, 10));
+
+  // statuses are printed as jobs finish, so nothing piles up however many records there are
+  std::mutex printLock;
+  int failed = 0;
+  farm.setStatusHook([&](size_t index, const pdf_form_fill_farm::job_status_t& status) {
+    std::lock_guard<std::mutex> guard(printLock);
+    if(status.status != eSuccess) {
+      printf("%s: %s\n", status.outputPath.c_str(), status.error.c_str());
+      failed++;
+    } else if(!status.error.empty()) {
+      printf("%s: left out %s\n", status.outputPath.c_str(), status.error.c_str());
+    }
+  });
+
+  FILE* jobs = fopen(argv[3], "r");
+  if(jobs == NULL) {
+    printf("failed to open jobs %s\n", argv[3]);
+    return 1;
+  }
+
+  char templatePath[1024], recordsPath[1024], prefix[1024];
+  while(fscanf(jobs, "%1023s %1023s %1023s", templatePath, recordsPath, prefix) == 3) {
+    FILE* records = fopen(recordsPath, "r");
+    if(records == NULL) {
+      printf("failed to open records %s\n", recordsPath);
+      continue;
+    }
+
+    // the farm loads the templates, and binds the data to them as it fills
+    pdf_form_data::format_t format;
+    std::unique_ptr<pdf_form_data> reader;
+    if(pdf_form_data::formatFromPath(recordsPath, format)) {
+      reader.reset(new pdf_form_data(records, format));
+    }
+
+    size_t count = 0;
+    pdf_form_fill_farm::job_t job;
+    while(reader ? reader->next(job.data) : readRecord(records, job.data)) {
+      job.templatePath = templatePath;
+      job.outputPath = std::string(prefix) + std::to_string(count++) + ".pdf";
+      farm.submit(job);
+      job.data.clear();
+    }
+    fclose(records);
+
+    if(reader && !reader->getError().empty()) {
+      printf("failed to read %s: %s\n", recordsPath, reader->getError().c_str());
+    }
+  }
+  fclose(jobs);
+
+  farm.wait();
+  printf("%d jobs failed\n", failed);
+  return failed == 0 ? 0 : 1;
+}
+
+/**
+ * compile a template into a fill plan, which --batch then loads instead of parsing the template
+ */
+int compile(int argc, char** argv) {
+  pdf_form_fill pff;
+  pdf_form_fill::form_template_t form;
+
+  if(pff.loadTemplate(form, argv[2]) != eSuccess) {
+    printf("failed to load template %s\n", argv[2]);
+    return 1;
+  }
+
+  if(pff.savePlan(form, argv[3]) != eSuccess) {
+    printf("failed to write plan %s\n", argv[3]);
+    return 1;
+  }
+  printf("compiled %zu fields into %s. %zu objects looked up, %zu of them already parsed\n", form.fieldIndex.size(), argv[3],
+    form.objectLookups, form.objectCacheHits);
+  return 0;
+}
+
+/**
+ * print the fields of a form as json, for validating data against it before filling
+ */
+int listFields(int argc, char** argv) {
+  pdf_form_fill pff;
+  pdf_form_fill::form_template_t form;
+
+  if(pff.loadTemplate(form, argv[2]) != eSuccess) {
+    printf("failed to load template %s\n", argv[2]);
+    return 1;
+  }
+
+  std::string json = pff.fieldsToJSON(form);
+  fwrite(json.data(), 1, json.size(), stdout);
+  return 0;
+}
 
 int main(int argc, char** argv) {
   EStatusCode status = eSuccess;
   PDFWriter writer;
   pdf_form_fill pff;
 
+  if(argc == 5 && std::string(argv[1]) == "--batch") {
+    return batch(argc, argv);
+  }
+
+  if(argc == 4 && std::string(argv[1]) == "--farm") {
+    return farm(argc, argv);
+  }
+
+  if(argc == 3 && std::string(argv[1]) == "--list-fields") {
+    return listFields(argc, argv);
+  }
+
+  if(argc == 4 && std::string(argv[1]) == "--compile") {
+    return compile(argc, argv);
+  }
+
+  if(argc != 3) {
+    printf("usage: %s <input.pdf> <output.pdf>\n", argv[0]);
+    printf("       %s --batch <template.pdf> <records.txt|.json|.ndjson|.csv> <output-prefix>\n", argv[0]);
+    printf("       %s --farm <workers> <jobs.txt>\n", argv[0]);
+    printf("       %s --list-fields <template.pdf>\n", argv[0]);
+    printf("       %s --compile <template.pdf> <template.pdf.plan>\n", argv[0]);
+    return 1;
+  }
+
   do {
     status = writer.ModifyPDF(
       argv[1],
       ePDFVersion13,
       argv[2],
-      LogConfiguration(true, true, argv[2])
+      LogConfiguration::DefaultLogConfiguration()
     );
 
     if(status != eSuccess) {
@@ -18,7 +260,7 @@ int main(int argc, char** argv) {
       break;
     }
 
-    pff.fillForm(writer, {
+    pdf_form_fill::fill_stats_t stats = pff.fillForm(writer, {
       {"Given Name Text Box"       , "Eric"},
       {"Family Name Text Box"      , "Jones"},
       {"House nr Text Box"         , "someplace"},
@@ -43,6 +285,10 @@ int main(int argc, char** argv) {
     if(status != eSuccess) {
       break;
     }
+
+    printf("filled %zu fields, skipped %zu, %zu unknown. %zu appearances written, %zu shared. %lld bytes in %.0fus\n",
+      stats.fieldsFilled, stats.fieldsSkipped, stats.unknownFields, stats.appearancesGenerated, stats.appearancesShared,
+      stats.bytesWritten, stats.totalMicros);
   } while(false);
 
   return 0;
@@ -0,0 +1,43 @@
+#ifndef __PDF_FORM_BENCH_ALLOC_H__
+#define __PDF_FORM_BENCH_ALLOC_H__
+
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+/**
+ * counts the heap allocations of the benchmarks. replaces the global operator new, so include it from one file only
+ */
+
+static std::atomic<size_t> allocations(0);
+
+void* operator new(std::size_t size) {
+  allocations++;
+  void* p = malloc(size == 0 ? 1 : size);
+  if(p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  free(p);
+}
+
+#endif //__PDF_FORM_BENCH_ALLOC_H__
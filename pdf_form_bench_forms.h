@@ -0,0 +1,173 @@
+#ifndef __PDF_FORM_BENCH_FORMS_H__
+#define __PDF_FORM_BENCH_FORMS_H__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ * synthetic forms for the benchmarks
+ */
+
+/**
+ * a pdf out of its objects, by object id (0 is left empty), with rootId for the catalog
+ */
+inline std::string writeSyntheticPDF(const std::vector<std::string>& objects, size_t rootId) {
+  std::string pdf = "%PDF-1.4\n";
+  std::vector<size_t> offsets(objects.size(), 0);
+  for(size_t id = 1; id < objects.size(); id++) {
+    offsets[id] = pdf.size();
+    pdf += std::to_string(id) + " 0 obj\n" + objects[id] + "\nendobj\n";
+  }
+
+  size_t xref = pdf.size();
+  char entry[32];
+  pdf += "xref\n0 " + std::to_string(objects.size()) + "\n0000000000 65535 f \n";
+  for(size_t id = 1; id < objects.size(); id++) {
+    snprintf(entry, sizeof(entry), "%010zu 00000 n \n", offsets[id]);
+    pdf += entry;
+  }
+  pdf += "trailer\n<< /Size " + std::to_string(objects.size()) + " /Root " + std::to_string(rootId) + " 0 R >>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+  return pdf;
+}
+
+inline std::string syntheticRect(size_t index, double width, double height) {
+  double x = 20 + (index % 5) * 110;
+  double y = 20 + (index / 5 % 40) * 20;
+  return "/Rect [ " + std::to_string(x) + " " + std::to_string(y) + " " + std::to_string(x + width) + " " + std::to_string(y + height) + " ]";
+}
+
+/**
+ * a one page pdf with fieldCount text fields, each field being its own widget
+ */
+inline std::string makeSyntheticForm(size_t fieldCount) {
+  const size_t firstFieldId = 6;
+  std::vector<std::string> objects(firstFieldId + fieldCount);
+
+  std::string fieldRefs;
+  for(size_t i = 0; i < fieldCount; i++) {
+    fieldRefs += std::to_string(firstFieldId + i) + " 0 R ";
+  }
+
+  objects[1] = "<< /Type /Catalog /Pages 2 0 R /AcroForm 5 0 R >>";
+  objects[2] = "<< /Type /Pages /Kids [ 3 0 R ] /Count 1 >>";
+  objects[3] = "<< /Type /Page /Parent 2 0 R /MediaBox [ 0 0 595 842 ] /Annots [ " + fieldRefs + "] >>";
+  objects[4] = "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica /Encoding /WinAnsiEncoding >>";
+  objects[5] = "<< /Fields [ " + fieldRefs + "] /DR << /Font << /Helv 4 0 R >> >> /DA (/Helv 0 Tf 0 g) >>";
+
+  for(size_t i = 0; i < fieldCount; i++) {
+    objects[firstFieldId + i] = "<< /Type /Annot /Subtype /Widget /FT /Tx /T (field" + std::to_string(i) + ") " + syntheticRect(i, 100, 16) +
+      " /P 3 0 R /F 4 /DA (/Helv 10 Tf 0 g) >>";
+  }
+  return writeSyntheticPDF(objects, 1);
+}
+
+/**
+ * a synthetic form with every kind of field fill handles, and the full names of its fields by kind
+ */
+typedef struct {
+  std::string pdf;
+  std::vector<std::string> textFields;
+  std::vector<std::string> choiceFields;
+  std::vector<std::string> buttonFields;
+} synthetic_form_t;
+
+/**
+ * a one page pdf with fieldCount fields, text fields, combo boxes and checkboxes in turn, each field its own widget
+ * with an appearance. depth 0 puts every field at the top of the form. otherwise the fields go in groups of 10, each
+ * at the bottom of a chain of depth parent fields
+ */
+inline synthetic_form_t makeMixedSyntheticForm(size_t fieldCount, size_t depth) {
+  synthetic_form_t form;
+  std::vector<std::string> objects(6);
+  auto addObject = [&](const std::string& object) {
+    objects.push_back(object);
+    return objects.size() - 1;
+  };
+  auto addStream = [&](const std::string& dictionary, const std::string& content) {
+    return addObject("<< " + dictionary + " /Length " + std::to_string(content.size()) + " >>\nstream\n" + content + "\nendstream");
+  };
+  auto ref = [](size_t id) {
+    return std::to_string(id) + " 0 R";
+  };
+
+  size_t textAppearanceId = addStream("/Type /XObject /Subtype /Form /BBox [ 0 0 100 16 ] /Resources << /Font << /Helv 4 0 R >> >>", "/Tx BMC\nEMC");
+  size_t onAppearanceId = addStream("/Type /XObject /Subtype /Form /BBox [ 0 0 16 16 ]", "0 g 3 3 10 10 re f");
+  size_t offAppearanceId = addStream("/Type /XObject /Subtype /Form /BBox [ 0 0 16 16 ]", "0 G 0.5 0.5 15 15 re S");
+
+  std::string annots;
+  std::string topFields;
+  for(size_t group = 0; group * 10 < fieldCount; group++) {
+    // the chain of parents, top first. every one of them gets its kid filled in once it exists
+    std::string prefix;
+    size_t parentId = 0;
+    std::vector<size_t> chain;
+    for(size_t level = 0; level < depth; level++) {
+      std::string name = level == 0 ? "g" + std::to_string(group) : "l" + std::to_string(level);
+      size_t id = addObject("<< /T (" + name + ")" + (parentId != 0 ? " /Parent " + ref(parentId) : "") + " /Kids [ ");
+      prefix += name + ".";
+      if(parentId != 0) {
+        objects[parentId] += ref(id) + " ";
+      } else {
+        topFields += ref(id) + " ";
+      }
+      parentId = id;
+      chain.push_back(id);
+    }
+
+    for(size_t i = group * 10; i < fieldCount && i < (group + 1) * 10; i++) {
+      std::string name = "f" + std::to_string(i);
+      std::string field = "<< /Type /Annot /Subtype /Widget /T (" + name + ") /P 3 0 R /F 4" + (parentId != 0 ? " /Parent " + ref(parentId) : "");
+      switch(i % 3) {
+        case 0: {
+          field += " /FT /Tx " + syntheticRect(i, 100, 16) + " /DA (/Helv 10 Tf 0 g) /AP << /N " + ref(textAppearanceId) + " >> >>";
+          form.textFields.push_back(prefix + name);
+          break;
+        }
+        case 1: {
+          field += " /FT /Ch /Ff 131072 /Opt [ (one) (two) (three) ] " + syntheticRect(i, 100, 16) + " /DA (/Helv 10 Tf 0 g) /AP << /N " + ref(textAppearanceId) + " >> >>";
+          form.choiceFields.push_back(prefix + name);
+          break;
+        }
+        default: {
+          field += " /FT /Btn " + syntheticRect(i, 16, 16) + " /AS /Off /AP << /N << /Yes " + ref(onAppearanceId) + " /Off " + ref(offAppearanceId) + " >> >> >>";
+          form.buttonFields.push_back(prefix + name);
+          break;
+        }
+      }
+
+      size_t id = addObject(field);
+      annots += ref(id) + " ";
+      if(parentId != 0) {
+        objects[parentId] += ref(id) + " ";
+      } else {
+        topFields += ref(id) + " ";
+      }
+    }
+
+    for(size_t id : chain) {
+      objects[id] += "] >>";
+    }
+  }
+
+  objects[1] = "<< /Type /Catalog /Pages 2 0 R /AcroForm 5 0 R >>";
+  objects[2] = "<< /Type /Pages /Kids [ 3 0 R ] /Count 1 >>";
+  objects[3] = "<< /Type /Page /Parent 2 0 R /MediaBox [ 0 0 595 842 ] /Annots [ " + annots + "] >>";
+  objects[4] = "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica /Encoding /WinAnsiEncoding >>";
+  objects[5] = "<< /Fields [ " + topFields + "] /DR << /Font << /Helv 4 0 R >> >> /DA (/Helv 0 Tf 0 g) >>";
+  form.pdf = writeSyntheticPDF(objects, 1);
+  return form;
+}
+
+inline bool writeSyntheticForm(const std::string& path, size_t fieldCount) {
+  std::string pdf = makeSyntheticForm(fieldCount);
+  FILE* file = fopen(path.c_str(), "wb");
+  if(file == NULL) {
+    return false;
+  }
+  bool written = fwrite(pdf.data(), 1, pdf.size(), file) == pdf.size();
+  return fclose(file) == 0 && written;
+}
+
+#endif //__PDF_FORM_BENCH_FORMS_H__
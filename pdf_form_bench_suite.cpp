@@ -0,0 +1,317 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <chrono>
+
+#include "pdf_form_fill.h"
+#include "pdf_form_sink.h"
+#include "pdf_form_bench_forms.h"
+#include "pdf_form_bench_alloc.h"
+
+/**
+ * benchmark suite of the fill pipeline. runs synthetic forms of 10 to 10000 fields, flat and nested 8 deep, and times
+ * the stages of a fill apart:
+ *   parse        loading the template into a form model
+ *   walk         a fill without data, just the field tree written back (writeFilledFields)
+ *   text         text field updates, with their appearances
+ *   text-shared  the same, with one value everywhere, so a single appearance stream gets written
+ *   appearance   the part of text that goes into writing appearance streams, text less text-shared
+ *   choice       combo box updates, with their appearances
+ *   button       checkbox updates
+ *   end          EndPDF after filling every field: the fonts, xref and trailer
+ *   document     a whole document with every field filled, start to end
+ * every case runs in a process of its own, so its peak rss is its own.
+ * prints a json object per line. with --baseline <file> holding the output of an earlier run, it also compares the
+ * us_per_doc of every stage against it, and exits with 2 when any got slower by more than --tolerance (a fraction,
+ * 0.25 by default)
+ *
+ * usage: pdf_form_bench_suite [--max-fields <n>] [--baseline <file>] [--tolerance <fraction>]
+ */
+
+typedef struct {
+  std::string form;
+  size_t fields;
+  std::string stage;
+  size_t runs;
+  double micros; // per document
+  double allocations; // per document
+} result_t;
+
+typedef struct {
+  size_t runs = 0;
+  double micros = 0;
+  size_t allocations = 0;
+} timing_t;
+
+static const size_t NESTED_DEPTH = 8;
+
+template <typename F>
+void timeRun(timing_t& timing, F work) {
+  size_t allocationsBefore = allocations;
+  auto start = std::chrono::steady_clock::now();
+  work();
+  timing.micros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  timing.allocations += allocations - allocationsBefore;
+  timing.runs++;
+}
+
+/**
+ * fill once into memory, timing the fill and EndPDF apart
+ */
+bool fillOnce(pdf_form_fill& pff, const pdf_form_fill::form_template_t& form, const std::map<std::string, pdf_form_fill::pdf_value_t>& data, timing_t& fill, timing_t& end) {
+  PDFWriter writer;
+  InputByteArrayStream source((IOBasicTypes::Byte*)form.data, form.size);
+  pdf_form_buffer_sink output(form.size * 2);
+
+  if(writer.ModifyPDFForStream(&source, &output, false, ePDFVersion13) != eSuccess) {
+    return false;
+  }
+
+  timeRun(fill, [&] { pff.fillForm(writer, form, data); });
+
+  EStatusCode status = eSuccess;
+  timeRun(end, [&] { status = writer.EndPDFForStream(); });
+  return status == eSuccess;
+}
+
+long peakRss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void printResult(const result_t& result, long peakRssKB) {
+  printf("{\"form\": \"%s\", \"fields\": %zu, \"stage\": \"%s\", \"runs\": %zu, \"us_per_doc\": %.2f, \"docs_per_sec\": %.2f, "
+    "\"us_per_field\": %.4f, \"allocations_per_doc\": %.1f, \"peak_rss_kb\": %ld}\n",
+    result.form.c_str(), result.fields, result.stage.c_str(), result.runs, result.micros, result.micros > 0 ? 1e6 / result.micros : 0,
+    result.fields > 0 ? result.micros / result.fields : 0, result.allocations, peakRssKB);
+}
+
+/**
+ * run every stage of one form, and print them
+ */
+int runCase(const std::string& shape, size_t fieldCount) {
+  typedef std::map<std::string, pdf_form_fill::pdf_value_t> data_t;
+
+  synthetic_form_t synthetic = makeMixedSyntheticForm(fieldCount, shape == "nested" ? NESTED_DEPTH : 0);
+  // about the same number of fields for every size, so the small ones don't come down to timer noise
+  size_t runs = std::max<size_t>(3, 100000 / fieldCount);
+  pdf_form_fill pff;
+  std::vector<result_t> results;
+
+  auto addResult = [&](const char* stage, const timing_t& timing) {
+    results.push_back({ shape, fieldCount, stage, timing.runs, timing.micros / timing.runs, (double)timing.allocations / timing.runs });
+  };
+
+  timing_t parse;
+  for(size_t i = 0; i < runs; i++) {
+    pdf_form_fill::form_template_t form;
+    EStatusCode status = eSuccess;
+    timeRun(parse, [&] { status = pff.loadTemplate(form, synthetic.pdf.data(), synthetic.pdf.size()); });
+    if(status != eSuccess) {
+      fprintf(stderr, "failed to load the %s form of %zu fields\n", shape.c_str(), fieldCount);
+      return 1;
+    }
+  }
+  addResult("parse", parse);
+
+  pdf_form_fill::form_template_t form;
+  if(pff.loadTemplate(form, synthetic.pdf.data(), synthetic.pdf.size()) != eSuccess) {
+    return 1;
+  }
+
+  data_t none, texts, sameTexts, choices, buttons, everything;
+  for(size_t i = 0; i < synthetic.textFields.size(); i++) {
+    texts[synthetic.textFields[i]] = "value " + std::to_string(i);
+    sameTexts[synthetic.textFields[i]] = "same value";
+  }
+  for(const std::string& name : synthetic.choiceFields) {
+    choices[name] = "two";
+  }
+  for(const std::string& name : synthetic.buttonFields) {
+    buttons[name] = true;
+  }
+  everything.insert(texts.begin(), texts.end());
+  everything.insert(choices.begin(), choices.end());
+  everything.insert(buttons.begin(), buttons.end());
+
+  const std::pair<const char*, const data_t*> fills[] = {
+    { "walk", &none },
+    { "text", &texts },
+    { "text-shared", &sameTexts },
+    { "choice", &choices },
+    { "button", &buttons },
+    { "end", &everything },
+  };
+
+  std::map<std::string, timing_t> timings;
+  for(const auto& fill : fills) {
+    timing_t& timing = timings[fill.first];
+    timing_t end;
+    for(size_t i = 0; i < runs; i++) {
+      if(!fillOnce(pff, form, *fill.second, timing, end)) {
+        fprintf(stderr, "failed to fill the %s form of %zu fields\n", shape.c_str(), fieldCount);
+        return 1;
+      }
+    }
+
+    if(strcmp(fill.first, "end") == 0) {
+      // only the EndPDF part of it counts here
+      timing = end;
+    }
+    addResult(fill.first, timing);
+  }
+
+  timing_t appearance = timings["text"];
+  appearance.micros = std::max(0.0, appearance.micros - timings["text-shared"].micros);
+  appearance.allocations = appearance.allocations > timings["text-shared"].allocations ? appearance.allocations - timings["text-shared"].allocations : 0;
+  addResult("appearance", appearance);
+
+  timing_t document;
+  for(size_t i = 0; i < runs; i++) {
+    EStatusCode status = eSuccess;
+    timeRun(document, [&] {
+      pdf_form_buffer_sink output(form.size * 2);
+      status = pff.fillTemplate(form, everything, &output);
+    });
+    if(status != eSuccess) {
+      fprintf(stderr, "failed to fill the %s form of %zu fields\n", shape.c_str(), fieldCount);
+      return 1;
+    }
+  }
+  addResult("document", document);
+
+  long rss = peakRss();
+  for(const result_t& result : results) {
+    printResult(result, rss);
+  }
+  fflush(stdout);
+  return 0;
+}
+
+/**
+ * us_per_doc of every form, size and stage of an earlier run
+ */
+std::map<std::string, double> readBaseline(const char* path) {
+  std::map<std::string, double> baseline;
+  FILE* file = fopen(path, "r");
+  if(file == NULL) {
+    return baseline;
+  }
+
+  char line[1024];
+  char form[64], stage[64];
+  size_t fields, runs;
+  double micros;
+  while(fgets(line, sizeof(line), file) != NULL) {
+    if(sscanf(line, "{\"form\": \"%63[^\"]\", \"fields\": %zu, \"stage\": \"%63[^\"]\", \"runs\": %zu, \"us_per_doc\": %lf", form, &fields, stage, &runs, &micros) == 5) {
+      baseline[std::string(form) + " " + std::to_string(fields) + " " + stage] = micros;
+    }
+  }
+  fclose(file);
+  return baseline;
+}
+
+/**
+ * compare a run, read back from its output, against the baseline. returns how many stages regressed
+ */
+int compareWithBaseline(const std::map<std::string, double>& baseline, const std::map<std::string, double>& current, double tolerance) {
+  int regressions = 0;
+  for(const auto& stage : current) {
+    auto found = baseline.find(stage.first);
+    // appearance is a difference of two timings, far too noisy to gate on
+    if(found == baseline.end() || found->second <= 0 || stage.first.find(" appearance") != std::string::npos) {
+      continue;
+    }
+
+    double change = stage.second / found->second - 1;
+    if(change > tolerance) {
+      fprintf(stderr, "regression: %s %.2fus -> %.2fus (+%.0f%%)\n", stage.first.c_str(), found->second, stage.second, change * 100);
+      regressions++;
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, char** argv) {
+  size_t maxFields = 10000;
+  const char* baselinePath = NULL;
+  double tolerance = 0.25;
+
+  for(int i = 1; i + 1 < argc; i += 2) {
+    if(strcmp(argv[i], "--max-fields") == 0) {
+      maxFields = strtoul(argv[i + 1], NULL, 10);
+    } else if(strcmp(argv[i], "--baseline") == 0) {
+      baselinePath = argv[i + 1];
+    } else if(strcmp(argv[i], "--tolerance") == 0) {
+      tolerance = strtod(argv[i + 1], NULL);
+    }
+  }
+
+  // the cases write into a temporary file as well as stdout, for comparing with the baseline after
+  char resultsPath[] = "/tmp/pdf_form_bench_suite_XXXXXX";
+  int resultsFd = mkstemp(resultsPath);
+  if(resultsFd < 0) {
+    fprintf(stderr, "failed to create %s\n", resultsPath);
+    return 1;
+  }
+
+  const char* shapes[] = { "flat", "nested" };
+  int failed = 0;
+  for(const char* shape : shapes) {
+    for(size_t fieldCount = 10; fieldCount <= maxFields; fieldCount *= 10) {
+      int output[2];
+      if(pipe(output) != 0) {
+        return 1;
+      }
+
+      // nothing buffered for the child to inherit and print a second time
+      fflush(stdout);
+      pid_t child = fork();
+      if(child == 0) {
+        close(output[0]);
+        dup2(output[1], STDOUT_FILENO);
+        close(output[1]);
+        _exit(runCase(shape, fieldCount));
+      }
+      close(output[1]);
+
+      char buffer[4096];
+      ssize_t size;
+      while((size = read(output[0], buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, size, stdout);
+        if(write(resultsFd, buffer, size) != size) {
+          failed++;
+        }
+      }
+      close(output[0]);
+
+      int status = 0;
+      waitpid(child, &status, 0);
+      if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "the %s form of %zu fields failed\n", shape, fieldCount);
+        failed++;
+      }
+    }
+  }
+  fflush(stdout);
+  close(resultsFd);
+
+  int regressions = 0;
+  if(baselinePath != NULL) {
+    std::map<std::string, double> baseline = readBaseline(baselinePath);
+    if(baseline.empty()) {
+      fprintf(stderr, "no results in baseline %s\n", baselinePath);
+      failed++;
+    } else {
+      regressions = compareWithBaseline(baseline, readBaseline(resultsPath), tolerance);
+    }
+  }
+  unlink(resultsPath);
+
+  if(failed > 0) {
+    return 1;
+  }
+  return regressions > 0 ? 2 : 0;
+}
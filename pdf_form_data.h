@@ -0,0 +1,590 @@
+#ifndef __PDF_FORM_DATA_H__
+#define __PDF_FORM_DATA_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "pdf_form_fill.h"
+
+/**
+ * reads fill data out of a stream of records, one record per call to next(). nothing but the record at hand is kept in
+ * memory, so a file of any length fills at constant memory.
+ *
+ * JSON: a top level array of objects, or objects one after another (NDJSON, or a single object). nested objects name
+ * fields by their fully qualified names, {"a": {"b": 1}} fills "a.b". strings stay strings, true/false are booleans,
+ * null is no value (off for buttons), whole numbers are integers and other numbers keep their text. arrays of strings
+ * are the options of a multiple selection choice field.
+ * CSV: RFC 4180, the first row names the fields, every row after it is a record. empty cells are left out.
+ *
+ * with the template the data is for, strings are bound to what their fields take: checkboxes get a boolean (off for
+ * "", 0, false, no and off), radio buttons the index of the kid to turn on (by export value, on state name or index) and
+ * multiple selection choice fields an array, split at |. without one, CSV cells of true and false become booleans
+ */
+class pdf_form_data {
+  public:
+    typedef enum {
+      JSON,
+      CSV,
+    } format_t;
+
+    typedef std::map<std::string, pdf_form_fill::pdf_value_t> record_t;
+
+  private:
+    static const size_t READ_SIZE = 65536;
+
+    FILE* input;
+    format_t format;
+    const pdf_form_fill::form_template_t* form;
+
+    std::vector<char> buffer;
+    size_t position = 0;
+    size_t length = 0;
+    size_t line = 1;
+
+    bool started = false;
+    bool inArray = false;
+    bool ended = false;
+    std::vector<std::string> header;
+    size_t records = 0;
+    std::string error;
+    std::string bindError;
+
+    int peek() {
+      if(position == length) {
+        length = fread(buffer.data(), 1, buffer.size(), input);
+        position = 0;
+        if(length == 0) {
+          return EOF;
+        }
+      }
+      return (unsigned char)buffer[position];
+    }
+
+    int get() {
+      int c = peek();
+      if(c != EOF) {
+        position++;
+        if(c == '\n') {
+          line++;
+        }
+      }
+      return c;
+    }
+
+    void skipSpace() {
+      int c;
+      while((c = peek()) == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        get();
+      }
+    }
+
+    // a byte order mark, as spreadsheets like to write them
+    void skipByteOrderMark() {
+      if(peek() != EOF && length - position >= 3 && buffer[position] == '\xEF' && buffer[position + 1] == '\xBB' && buffer[position + 2] == '\xBF') {
+        position += 3;
+      }
+    }
+
+    bool fail(const std::string& message) {
+      error = message + " at line " + std::to_string(line);
+      return false;
+    }
+
+    static void appendUTF8(unsigned long code, std::string& out) {
+      if(code < 0x80) {
+        out += (char)code;
+      } else if(code < 0x800) {
+        out += (char)(0xC0 | (code >> 6));
+        out += (char)(0x80 | (code & 0x3F));
+      } else if(code < 0x10000) {
+        out += (char)(0xE0 | (code >> 12));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+      } else {
+        out += (char)(0xF0 | (code >> 18));
+        out += (char)(0x80 | ((code >> 12) & 0x3F));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+      }
+    }
+
+    bool readHex4(unsigned long& code) {
+      code = 0;
+      for(int i = 0; i < 4; i++) {
+        int c = get();
+        code <<= 4;
+        if(c >= '0' && c <= '9') {
+          code |= c - '0';
+        } else if(c >= 'a' && c <= 'f') {
+          code |= c - 'a' + 10;
+        } else if(c >= 'A' && c <= 'F') {
+          code |= c - 'A' + 10;
+        } else {
+          return fail("bad \\u escape");
+        }
+      }
+      return true;
+    }
+
+    bool readString(std::string& out) {
+      out.clear();
+      if(get() != '"') {
+        return fail("expected a string");
+      }
+
+      while(true) {
+        int c = get();
+        if(c == EOF) {
+          return fail("unterminated string");
+        }
+        if(c == '"') {
+          return true;
+        }
+        if(c < 0x20) {
+          return fail("control character in string");
+        }
+        if(c != '\\') {
+          out += (char)c;
+          continue;
+        }
+
+        c = get();
+        switch(c) {
+          case '"': out += '"'; break;
+          case '\\': out += '\\'; break;
+          case '/': out += '/'; break;
+          case 'b': out += '\b'; break;
+          case 'f': out += '\f'; break;
+          case 'n': out += '\n'; break;
+          case 'r': out += '\r'; break;
+          case 't': out += '\t'; break;
+          case 'u': {
+            unsigned long code;
+            if(!readHex4(code)) {
+              return false;
+            }
+            // a surrogate pair is one character in two escapes
+            if(code >= 0xD800 && code < 0xDC00) {
+              unsigned long low;
+              if(get() != '\\' || get() != 'u' || !readHex4(low) || low < 0xDC00 || low >= 0xE000) {
+                return fail("bad surrogate pair");
+              }
+              code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            appendUTF8(code, out);
+            break;
+          }
+          default: {
+            return fail("bad escape");
+          }
+        }
+      }
+    }
+
+    // a number or a literal, as its text
+    std::string readWord() {
+      std::string word;
+      int c;
+      while((c = peek()) != EOF && (isalnum(c) || c == '-' || c == '+' || c == '.')) {
+        word += (char)get();
+      }
+      return word;
+    }
+
+    bool readScalar(pdf_form_fill::pdf_value_t& value) {
+      if(peek() == '"') {
+        std::string text;
+        if(!readString(text)) {
+          return false;
+        }
+        value = std::move(text);
+        return true;
+      }
+
+      std::string word = readWord();
+      if(word == "true") {
+        value = true;
+      } else if(word == "false") {
+        value = false;
+      } else if(word == "null") {
+        value.set();
+      } else if(!word.empty() && (word[0] == '-' || isdigit((unsigned char)word[0]))) {
+        char* end;
+        long long integer = strtoll(word.c_str(), &end, 10);
+        if(*end == 0) {
+          value = integer;
+        } else {
+          // the text as written, 1.50 shows as 1.50
+          strtod(word.c_str(), &end);
+          if(*end != 0) {
+            return fail("bad number " + word);
+          }
+          value = std::move(word);
+        }
+      } else {
+        return fail(word.empty() ? "expected a value" : "unexpected " + word);
+      }
+      return true;
+    }
+
+    bool readArray(const std::string& name, record_t& data) {
+      get();
+      std::vector<std::string> options;
+
+      skipSpace();
+      if(peek() == ']') {
+        get();
+        data[name] = std::move(options);
+        return true;
+      }
+
+      while(true) {
+        skipSpace();
+        if(peek() == '{' || peek() == '[') {
+          return fail("arrays of " + name + " can only hold strings, numbers and booleans");
+        }
+
+        pdf_form_fill::pdf_value_t item;
+        if(!readScalar(item)) {
+          return false;
+        }
+        options.push_back(item.ToString());
+
+        skipSpace();
+        int c = get();
+        if(c == ']') {
+          break;
+        }
+        if(c != ',') {
+          return fail("expected , or ] in array");
+        }
+      }
+
+      data[name] = std::move(options);
+      return true;
+    }
+
+    bool readObject(const std::string& prefix, record_t& data) {
+      get();
+      skipSpace();
+      if(peek() == '}') {
+        get();
+        return true;
+      }
+
+      std::string key;
+      while(true) {
+        skipSpace();
+        if(!readString(key)) {
+          return false;
+        }
+        skipSpace();
+        if(get() != ':') {
+          return fail("expected :");
+        }
+        skipSpace();
+
+        std::string name = prefix.empty() ? key : prefix + "." + key;
+        bool read;
+        if(peek() == '{') {
+          read = readObject(name, data);
+        } else if(peek() == '[') {
+          read = readArray(name, data);
+        } else {
+          read = readScalar(data[name]);
+        }
+        if(!read) {
+          return false;
+        }
+
+        skipSpace();
+        int c = get();
+        if(c == '}') {
+          return true;
+        }
+        if(c != ',') {
+          return fail("expected , or } in object");
+        }
+      }
+    }
+
+    bool nextJSON(record_t& data) {
+      skipSpace();
+      if(!started) {
+        started = true;
+        if(peek() == '[') {
+          get();
+          inArray = true;
+          skipSpace();
+          if(peek() == ']') {
+            return false;
+          }
+        }
+      } else if(inArray) {
+        // between records of an array
+        int c = get();
+        if(c == ']') {
+          return false;
+        }
+        if(c != ',') {
+          return fail("expected , or ] between records");
+        }
+        skipSpace();
+      }
+
+      if(peek() == EOF) {
+        return inArray ? fail("unterminated array") : false;
+      }
+      if(peek() != '{') {
+        return fail("expected a record object");
+      }
+      return readObject("", data);
+    }
+
+    /**
+     * one CSV row. false at the end of the input
+     */
+    bool readRow(std::vector<std::string>& cells) {
+      cells.clear();
+      if(peek() == EOF) {
+        return false;
+      }
+
+      std::string cell;
+      bool quoted = false;
+      while(true) {
+        int c = get();
+        if(quoted) {
+          if(c == EOF) {
+            return fail("unterminated quoted cell");
+          }
+          if(c == '"') {
+            if(peek() == '"') {
+              get();
+              cell += '"';
+            } else {
+              quoted = false;
+            }
+          } else {
+            cell += (char)c;
+          }
+          continue;
+        }
+
+        if(c == '"' && cell.empty()) {
+          quoted = true;
+        } else if(c == ',') {
+          cells.push_back(std::move(cell));
+          cell.clear();
+        } else if(c == '\r' && peek() == '\n') {
+          continue;
+        } else if(c == '\n' || c == EOF) {
+          cells.push_back(std::move(cell));
+          return true;
+        } else {
+          cell += (char)c;
+        }
+      }
+    }
+
+    bool nextCSV(record_t& data) {
+      if(!started) {
+        started = true;
+        if(!readRow(header)) {
+          return false;
+        }
+      }
+
+      std::vector<std::string> cells;
+      do {
+        if(!readRow(cells)) {
+          return false;
+        }
+      } while(cells.size() == 1 && cells[0].empty());
+
+      if(cells.size() > header.size()) {
+        return fail("more cells than columns");
+      }
+
+      for(size_t i = 0; i < cells.size(); i++) {
+        if(cells[i].empty()) {
+          continue;
+        }
+        if(form == NULL && (cells[i] == "true" || cells[i] == "false")) {
+          data[header[i]] = cells[i] == "true";
+        } else {
+          data[header[i]] = std::move(cells[i]);
+        }
+      }
+      return true;
+    }
+
+    static bool isOn(const pdf_form_fill::field_node_t& field, const std::string& text) {
+      if(text == field.onState) {
+        return true;
+      }
+
+      std::string lower;
+      for(char c : text) {
+        lower += (char)tolower((unsigned char)c);
+      }
+      return !(lower.empty() || lower == "0" || lower == "false" || lower == "no" || lower == "off");
+    }
+
+    static pdf_form_fill::pdf_value_t radioValue(const pdf_form_fill::field_node_t& field, const std::string& text) {
+      if(field.isWidget || !field.hasKids) {
+        // a single option, on or off
+        return isOn(field, text) ? pdf_form_fill::pdf_value_t(true) : pdf_form_fill::pdf_value_t();
+      }
+
+      // -1 when it's none of them, all off
+      return (long long)pdf_form_fill::findExportValue(field, text);
+    }
+
+    static pdf_form_fill::pdf_value_t splitOptions(const std::string& text) {
+      std::vector<std::string> options;
+      size_t start = 0;
+      while(true) {
+        size_t end = text.find('|', start);
+        options.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if(end == std::string::npos) {
+          break;
+        }
+        start = end + 1;
+      }
+      return options;
+    }
+
+  public:
+    /**
+     * read records out of input, which stays the caller's to close. form, when given, is what the strings get bound to
+     */
+    pdf_form_data(FILE* input, format_t format, const pdf_form_fill::form_template_t* form = NULL) : buffer(READ_SIZE) {
+      this->input = input;
+      this->format = format;
+      this->form = form;
+    }
+
+    pdf_form_data(const pdf_form_data&) = delete;
+    pdf_form_data& operator=(const pdf_form_data&) = delete;
+
+    /**
+     * the format of a data file by its extension: .json, .ndjson or .jsonl for JSON, .csv for CSV. false for anything else
+     */
+    static bool formatFromPath(const std::string& path, format_t& format) {
+      size_t dot = path.rfind('.');
+      if(dot == std::string::npos) {
+        return false;
+      }
+
+      std::string extension = path.substr(dot + 1);
+      if(extension == "json" || extension == "ndjson" || extension == "jsonl") {
+        format = JSON;
+        return true;
+      }
+      if(extension == "csv") {
+        format = CSV;
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * turn the strings of a record into what their fields in form take, as records read with a form are. for records
+     * that come from anywhere else, so the same strings fill the same way wherever they're read from.
+     * a value that can't go into its field is left out of data, and why is returned, "" when everything bound
+     */
+    static std::string bind(const pdf_form_fill::form_template_t& form, record_t& data) {
+      std::string problems;
+      for(auto item = data.begin(); item != data.end();) {
+        const pdf_form_fill::field_index_entry_t* entry = form.findField(item->first);
+        if(entry == NULL) {
+          ++item;
+          continue;
+        }
+
+        const pdf_form_fill::field_node_t& field = *entry->field;
+        bool radio = field.fieldType == "Btn" && ((field.flags >> 15) & 1) && !((field.flags >> 16) & 1);
+        if(radio && item->second.type() == pdf_form_fill::pdf_value_t::BOOL) {
+          // a bool is no kid index. false is all off, true is only a choice when there's a single option to take
+          if(!item->second.ToBool()) {
+            item->second = pdf_form_fill::pdf_value_t();
+          } else if(!field.isWidget && field.hasKids) {
+            problems += (problems.empty() ? "" : "; ") + item->first + ": true picks none of the radio buttons";
+            item = data.erase(item);
+            continue;
+          }
+          ++item;
+          continue;
+        }
+        if(item->second.type() != pdf_form_fill::pdf_value_t::STRING) {
+          ++item;
+          continue;
+        }
+
+        std::string text = item->second.ToString();
+        if(field.fieldType == "Btn") {
+          if((field.flags >> 16) & 1) {
+            // push buttons take nothing
+          } else if(radio) {
+            item->second = radioValue(field, text);
+          } else {
+            item->second = isOn(field, text);
+          }
+        } else if(field.fieldType == "Ch" && ((field.flags >> 21) & 1) && text.find('|') != std::string::npos) {
+          item->second = splitOptions(text);
+        }
+        ++item;
+      }
+      return problems;
+    }
+
+    /**
+     * read the next record into data, which should come in empty. false at the end of the input, or on an error,
+     * see getError()
+     */
+    bool next(record_t& data) {
+      if(ended) {
+        return false;
+      }
+      if(!started) {
+        skipByteOrderMark();
+      }
+
+      if(!(format == CSV ? nextCSV(data) : nextJSON(data))) {
+        ended = true;
+        return false;
+      }
+
+      if(form != NULL) {
+        bindError = bind(*form, data);
+      }
+      records++;
+      return true;
+    }
+
+    /**
+     * why reading stopped early, "" if it got to the end
+     */
+    const std::string& getError() const {
+      return error;
+    }
+
+    /**
+     * the values of the last record that were left out, and why. "" if it all went into the form
+     */
+    const std::string& getBindError() const {
+      return bindError;
+    }
+
+    // records read so far
+    size_t getRecords() const {
+      return records;
+    }
+};
+
+#endif //__PDF_FORM_DATA_H__
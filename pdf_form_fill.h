@@ -2,21 +2,34 @@
 #define __PDF_FORM_FILL_H__
 
 #include <stdint.h>
+#include <cmath>
 #include <stdexcept>
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <variant>
 
 #include "PDFParser.h"
 #include "PDFObjectCast.h"
 #include "PDFDictionary.h"
 #include "PDFDocumentCopyingContext.h"
 #include "InputFile.h"
+#include "OutputFile.h"
+#include "InputByteArrayStream.h"
 #include "RefCountPtr.h"
 #include "PDFArray.h"
 #include "PDFName.h"
 #include "PDFIndirectObjectReference.h"
 #include "PDFStreamInput.h"
+#include "PDFStream.h"
 #include "IByteReader.h"
 #include "EStatusCode.h"
 #include "ParsedPrimitiveHelper.h"
@@ -34,213 +47,129 @@
 #include "XObjectContentContext.h"
 #include "PDFUsedFont.h"
 #include "PDFInteger.h"
+#include "PDFBoolean.h"
 #include "PDFReal.h"
 #include "PDFTextString.h"
 #include "PDFLiteralString.h"
 #include "Trace.h"
 
+#include "pdf_form_font.h"
+#include "pdf_form_layout.h"
+#include "pdf_form_sink.h"
+#include "pdf_form_rewrite.h"
+#include "pdf_form_serialize.h"
+#include "pdf_form_timer.h"
+#include "pdf_form_plan.h"
+#include "pdf_form_object_cache.h"
+
 class pdf_form_fill {
   public:
-    const std::string _NULL_ = "__MAGIC_NULL__";
-
+    /**
+     * a value to fill a field with. one variant, so a value is as big as its largest type and not the sum of them,
+     * strings get the small string buffer std::string has, and values move into maps without copying their text.
+     * radio buttons take the index or the export value of the kid to turn on, checkboxes a bool and multiple selection
+     * choice fields a list of strings (or a parsed PDFArray of strings)
+     */
     class pdf_value_t {
       public:
-        enum {
+        // in the order of the variant alternatives, type() is the variant index
+        typedef enum {
           NONE,
           INTEGER,
           DOUBLE,
           BOOL,
           STRING,
+          STRINGS,
           PDFARRAY,
-        };
+        } type_t;
+
       private:
-        int p_type = NONE;
-        union {
-          long long i_value;
-          double    d_value;
-          bool      b_value;
-        };
-        std::string s_value;
-        PDFObjectCastPtr<PDFArray> a_value;
+        std::variant<std::monostate, long long, double, bool, std::string, std::vector<std::string>, PDFObjectCastPtr<PDFArray>> value;
 
       public:
         void set() {
-          p_type = NONE;
+          value = std::monostate();
         }
 
         void set(long long value) {
-          i_value = value;
-          p_type = INTEGER;
+          this->value = value;
         }
 
         void set(double value) {
-          d_value = value;
-          p_type = DOUBLE;
+          this->value = value;
         }
 
         void set(bool value) {
-          b_value = value;
-          p_type = BOOL;
+          this->value = value;
         }
 
         void set(std::string value) {
-          s_value = value;
-          p_type = STRING;
-        }
-
-        void set(PDFObjectCastPtr<PDFArray> value) {
-          a_value = value;
-          p_type = PDFARRAY;
+          this->value = std::move(value);
         }
 
         void set(const char* value) {
-          s_value = value;
-          p_type = STRING;
-        }
-
-        void set(const pdf_value_t& m) {
-          p_type = m.p_type;
-          switch(p_type) {
-            case NONE: {
-              break;
-            }
-            case INTEGER: {
-              i_value = m.i_value;
-              break;
-            }
-            case DOUBLE: {
-              d_value = m.d_value;
-              break;
-            }
-            case BOOL: {
-              b_value = m.b_value;
-              break;
-            }
-            case STRING: {
-              s_value = m.s_value;
-              break;
-            }
-            case PDFARRAY: {
-              a_value = m.a_value;
-            }
-            default: {
-              break;
-            }
-          }
-        }
-
-
-        pdf_value_t() {
-          p_type = NONE;
-        }
-
-        pdf_value_t(const pdf_value_t& value) {
-          set(value);
+          this->value.emplace<std::string>(value);
         }
 
-        pdf_value_t(long long value) {
-          set(value);
+        void set(std::vector<std::string> value) {
+          this->value = std::move(value);
         }
 
-        pdf_value_t(double value) {
-          set(value);
-        }
-
-        pdf_value_t(std::string value) {
-          set(value);
-        }
-
-        pdf_value_t(const char* value) {
-          set(value);
-        }
-
-        pdf_value_t(bool value) {
-          set(value);
+        void set(PDFObjectCastPtr<PDFArray> value) {
+          this->value = value;
         }
 
-        pdf_value_t(PDFObjectCastPtr<PDFArray> value) {
-          set(value);
+        pdf_value_t() {}
+        pdf_value_t(const pdf_value_t& value) = default;
+        pdf_value_t(pdf_value_t&& value) = default;
+        pdf_value_t& operator=(const pdf_value_t& value) = default;
+        pdf_value_t& operator=(pdf_value_t&& value) = default;
+
+        pdf_value_t(int value) : value((long long)value) {}
+        pdf_value_t(long long value) : value(value) {}
+        pdf_value_t(double value) : value(value) {}
+        pdf_value_t(bool value) : value(value) {}
+        pdf_value_t(std::string value) : value(std::move(value)) {}
+        pdf_value_t(const char* value) : value(std::in_place_type<std::string>, value) {}
+        pdf_value_t(std::vector<std::string> value) : value(std::move(value)) {}
+        pdf_value_t(PDFObjectCastPtr<PDFArray> value) : value(value) {}
+
+        type_t type() const {
+          return (type_t)value.index();
         }
 
-        std::string type() {
-          switch(p_type) {
-            case NONE: {
-              return "none";
-            }
-            case INTEGER: {
-              return "int";
-            }
-            case DOUBLE: {
-              return "double";
-            }
-            case BOOL: {
-              return "bool";
-            }
-            case STRING: {
-              return "string";
-            }
-            case PDFARRAY: {
-              return "pdfarray";
-            }
-            default: {
-              return "none";
-            }
-          }
+        // the type by name, for printing
+        const char* typeName() const {
+          static const char* names[] = { "none", "int", "double", "bool", "string", "strings", "pdfarray" };
+          return names[value.index()];
         }
 
-        bool operator==(const pdf_value_t& m) {
-          if(p_type != m.p_type) {
+        bool operator==(const pdf_value_t& m) const {
+          if(type() != m.type()) {
             return false;
           }
 
-          switch(p_type) {
+          switch(type()) {
             case NONE: {
               return true;
             }
             case INTEGER: {
-              return i_value == m.i_value;
+              return std::get<long long>(value) == std::get<long long>(m.value);
             }
             case DOUBLE: {
-              return d_value == m.d_value;
+              return std::get<double>(value) == std::get<double>(m.value);
             }
             case BOOL: {
-              return b_value == m.b_value;
+              return std::get<bool>(value) == std::get<bool>(m.value);
             }
             case STRING: {
-              return s_value == m.s_value;
-            }
-            case PDFARRAY: {
-              return a_value.GetPtr() == m.a_value.GetPtr();
-            }
-            default: {
-              return false;
-            }
-          }
-        }
-
-        bool operator!=(const pdf_value_t& m) {
-          if(p_type != m.p_type) {
-            return true;
-          }
-
-          switch(p_type) {
-            case NONE: {
-              return false;
-            }
-            case INTEGER: {
-              return i_value != m.i_value;
-            }
-            case DOUBLE: {
-              return d_value != m.d_value;
-            }
-            case BOOL: {
-              return b_value != m.b_value;
+              return std::get<std::string>(value) == std::get<std::string>(m.value);
             }
-            case STRING: {
-              return s_value != m.s_value;
+            case STRINGS: {
+              return std::get<std::vector<std::string>>(value) == std::get<std::vector<std::string>>(m.value);
             }
             case PDFARRAY: {
-              return a_value.GetPtr() != m.a_value.GetPtr();
+              return std::get<PDFObjectCastPtr<PDFArray>>(value).GetPtr() == std::get<PDFObjectCastPtr<PDFArray>>(m.value).GetPtr();
             }
             default: {
               return false;
@@ -248,53 +177,23 @@ class pdf_form_fill {
           }
         }
 
-        void operator=(long long value) {
-          set(value);
-        }
-
-        void operator=(double value) {
-          set(value);
-        }
-
-        void operator=(bool value) {
-          set(value);
-        }
-
-        void operator=(std::string value) {
-          set(value);
+        bool operator!=(const pdf_value_t& m) const {
+          return !(*this == m);
         }
 
-        void operator=(const char* value) {
-          set(value);
-        }
-
-        void operator=(const pdf_value_t& value) {
-          set(value);
-        }
-
-        void operator=(PDFObjectCastPtr<PDFArray> value) {
-          set(value);
-        }
-
-        long long ToInteger() {
-          switch(p_type) {
-            case NONE: {
-              return 0;
-            }
+        long long ToInteger() const {
+          switch(type()) {
             case INTEGER: {
-              return i_value;
+              return std::get<long long>(value);
             }
             case DOUBLE: {
-              return (long long)d_value;
+              return (long long)std::get<double>(value);
             }
             case BOOL: {
-              return (long long)b_value;
+              return (long long)std::get<bool>(value);
             }
             case STRING: {
-              return strtoll(s_value.c_str(), NULL, 0);
-            }
-            case PDFARRAY: {
-              return 0;
+              return strtoll(std::get<std::string>(value).c_str(), NULL, 0);
             }
             default: {
               return 0;
@@ -302,25 +201,19 @@ class pdf_form_fill {
           }
         }
 
-        double ToDouble() {
-          switch(p_type) {
-            case NONE: {
-              return 0.0;
-            }
+        double ToDouble() const {
+          switch(type()) {
             case INTEGER: {
-              return (double)i_value;
+              return (double)std::get<long long>(value);
             }
             case DOUBLE: {
-              return d_value;
+              return std::get<double>(value);
             }
             case BOOL: {
-              return (double)b_value;
+              return (double)std::get<bool>(value);
             }
             case STRING: {
-              return strtod(s_value.c_str(), NULL);
-            }
-            case PDFARRAY: {
-              return 0.0;
+              return strtod(std::get<std::string>(value).c_str(), NULL);
             }
             default: {
               return 0.0;
@@ -328,25 +221,25 @@ class pdf_form_fill {
           }
         }
 
-        bool ToBool() {
-          switch(p_type) {
-            case NONE: {
-              return false;
-            }
+        bool ToBool() const {
+          switch(type()) {
             case INTEGER: {
-              return (bool)i_value;
+              return (bool)std::get<long long>(value);
             }
             case DOUBLE: {
-              return (bool)d_value;
+              return (bool)std::get<double>(value);
             }
             case BOOL: {
-              return b_value;
+              return std::get<bool>(value);
             }
             case STRING: {
-              return s_value.size() != 0;
+              return std::get<std::string>(value).size() != 0;
+            }
+            case STRINGS: {
+              return std::get<std::vector<std::string>>(value).size() != 0;
             }
             case PDFARRAY: {
-              return a_value.GetPtr() != NULL;
+              return std::get<PDFObjectCastPtr<PDFArray>>(value).GetPtr() != NULL;
             }
             default: {
               return false;
@@ -354,25 +247,19 @@ class pdf_form_fill {
           }
         }
 
-        std::string ToString() {
-          switch(p_type) {
-            case NONE: {
-              return "";
-            }
+        std::string ToString() const {
+          switch(type()) {
             case INTEGER: {
-              return std::to_string(i_value);
+              return std::to_string(std::get<long long>(value));
             }
             case DOUBLE: {
-              return std::to_string(d_value);
+              return std::to_string(std::get<double>(value));
             }
             case BOOL: {
-              return b_value ? "true" : "false";
+              return std::get<bool>(value) ? "true" : "false";
             }
             case STRING: {
-              return s_value;
-            }
-            case PDFARRAY: {
-              return "";
+              return std::get<std::string>(value);
             }
             default: {
               return "";
@@ -380,115 +267,502 @@ class pdf_form_fill {
           }
         }
 
-        PDFObjectCastPtr<PDFArray> ToPDFArray() {
-          switch(p_type) {
+        /**
+         * the strings of a multiple selection: the list, the strings of the PDFArray, or the one string of a single value
+         */
+        std::vector<std::string> ToStrings() const {
+          switch(type()) {
             case NONE: {
-              return NULL;
-            }
-            case INTEGER: {
-              return NULL;
-            }
-            case DOUBLE: {
-              return NULL;
+              return {};
             }
-            case BOOL: {
-              return NULL;
-            }
-            case STRING: {
-              return NULL;
+            case STRINGS: {
+              return std::get<std::vector<std::string>>(value);
             }
             case PDFARRAY: {
-              return a_value;
+              std::vector<std::string> strings;
+              PDFArray* array = std::get<PDFObjectCastPtr<PDFArray>>(value).GetPtr();
+              if(array == NULL) {
+                return strings;
+              }
+              SingleValueContainerIterator<PDFObjectVector> it = array->GetIterator();
+              while(it.MoveNext()) {
+                PDFObjectCastPtr<PDFLiteralString> item = it.GetItem();
+                if(item != NULL) {
+                  strings.push_back(item->GetValue());
+                }
+              }
+              return strings;
             }
             default: {
-              return NULL;
+              return { ToString() };
             }
           }
         }
+
+        PDFObjectCastPtr<PDFArray> ToPDFArray() const {
+          if(type() != PDFARRAY) {
+            return NULL;
+          }
+          return std::get<PDFObjectCastPtr<PDFArray>>(value);
+        }
     };
 
-    typedef struct {
-      bool debug;
-      AbstractContentContext::TextOptions* defaultTextOptions;
+    /**
+     * fill options. set the ones you need by name on a default constructed one, everything else stays off
+     */
+    typedef struct options_t {
+      bool debug = false;
+      AbstractContentContext::TextOptions* defaultTextOptions = NULL;
+      // only write the fields that get a value, and whichever parents have to be rewritten to point at them.
+      // everything else stays as it is in the original file, so the update grows with the data, not with the form
+      bool minimalUpdate = false;
+      // metrics of the defaultTextOptions font (pdf_form_font::get). measures text without going through freetype
+      const pdf_form_font* defaultFontMetrics = NULL;
+      // bake the widget appearances into the page content, then drop the widgets and the AcroForm. nothing can be
+      // edited anymore, but there are no fields left for viewers to render, and the field objects aren't written at all
+      bool flatten = false;
+      // fillTemplate and fillBatch only: write a new, compacted document (see pdf_form_rewrite.h) rather than append an
+      // incremental update to the template. fillForm writes into the caller's writer, which is always incremental
+      bool fullRewrite = false;
+      // lay out the text appearances of one document on this many threads, ahead of writing them. worth it for forms
+      // with hundreds of text fields, 0 or 1 lays them out one by one as the fields get written
+      unsigned int appearanceThreads = 0;
+
+      // a constructor of its own, so options_t() works as a default argument inside pdf_form_fill
+      options_t() {}
     } options_t;
 
+    /**
+     * what a fill did and where its time went. phases are timed on every fill, in microseconds. end, rewrite and bytes
+     * written of a whole document only come from fillTemplate, fillForm doesn't end the document. its bytes are those
+     * of the objects the fill wrote.
+     * layout, fonts and appearance writes are timed per appearance, only in builds with PDF_FORM_FILL_TIMERS defined.
+     * filled fields got a value they can take, skipped ones got one they can't (push buttons, signatures, no type),
+     * unknown ones are names in the data the form has no field for. shared appearances are ones an identical
+     * appearance already written stood in for
+     */
     typedef struct {
-      PDFWriter& writer;
-      PDFParser& reader;
-      PDFDocumentCopyingContext* copyingContext;
-      ObjectsContext& objectsContext;
-      std::map<std::string, pdf_value_t> data;
-      PDFObjectCastPtr<PDFDictionary> acroformDict;
-      options_t options;
-    } handles_t;
+      double resolveMicros = 0;
+      double writeMicros = 0;
+      double endMicros = 0;
+      double rewriteMicros = 0;
+      double totalMicros = 0;
+      double layoutMicros = 0;
+      double fontMicros = 0;
+      double appearanceWriteMicros = 0;
+      size_t fieldsVisited = 0;
+      size_t fieldsFilled = 0;
+      size_t fieldsSkipped = 0;
+      size_t unknownFields = 0;
+      size_t appearancesGenerated = 0;
+      size_t appearancesShared = 0;
+      long long bytesWritten = 0;
+    } fill_stats_t;
+
+    // gets the stats of every fill, for exporting them as metrics. called on the thread that did the fill
+    typedef std::function<void(const fill_stats_t& stats)> stats_hook_t;
+
+    /**
+     * the keys fills replace or drop when they rewrite a dictionary, a bit each. startModifiedDictionary takes a set of
+     * them, so filtering an entry is a mask test rather than string compares
+     */
+    typedef uint32_t key_set_t;
+    enum {
+      KEY_V = 1 << 0,
+      KEY_AS = 1 << 1,
+      KEY_AP = 1 << 2,
+      KEY_RV = 1 << 3,
+      KEY_KIDS = 1 << 4,
+      KEY_FIELDS = 1 << 5,
+      KEY_ACROFORM = 1 << 6,
+      KEY_CONTENTS = 1 << 7,
+      KEY_RESOURCES = 1 << 8,
+      KEY_ANNOTS = 1 << 9,
+      KEY_XOBJECT = 1 << 10,
+    };
+
+    /**
+     * a dictionary entry, already serialized: size bytes at offset of the dictionary bytes. keyBit is the bit of its key
+     * among the ones above, 0 for any other key
+     */
+    typedef struct {
+      std::string key;
+      size_t offset;
+      size_t size;
+      key_set_t keyBit;
+    } dictionary_entry_t;
+
+    /**
+     * a dictionary, its entries serialized one after the other. keys has the bits of all of them, so a rewrite that
+     * drops none of its keys copies bytes whole
+     */
+    typedef struct {
+      std::string bytes;
+      std::vector<dictionary_entry_t> entries;
+      key_set_t keys = 0;
+    } dictionary_entries_t;
+
+    /**
+     * the original appearance of a text widget, split around its /Tx BMC ... EMC text. the new text goes in between.
+     * widgets that share an appearance stream share one of these
+     */
+    typedef struct {
+      std::string before;
+      std::string after;
+    } appearance_t;
+
+    /**
+     * a DA string taken apart, with its font resolved once per template. fontId is the /DR font the DA names, 0 if DR
+     * doesn't have it. fontPath is a file for the same font out of the font directory, "" if there's none, and metrics
+     * its metrics. colorCode is the DA's own color operator, as is
+     */
+    typedef struct {
+      std::string fontName;
+      double fontSize = 0; // 0 is auto
+      AbstractContentContext::EColorSpace colorSpace = AbstractContentContext::eGray;
+      unsigned long colorValue = 0;
+      std::string colorCode;
+      ObjectIDType fontId = 0;
+      std::string fontPath;
+      const pdf_form_font* metrics = NULL;
+    } text_style_t;
+
+    /**
+     * one of the normal appearance streams of a widget, for flattening. state is its name under /N, "" when /N is the
+     * stream itself. box is the stream BBox as its Matrix places it
+     */
+    typedef struct {
+      std::string state;
+      ObjectIDType id;
+      PDFRectangle box;
+    } normal_appearance_t;
+
+    /**
+     * a field or widget dictionary of the template, with everything it inherits from its parents already resolved.
+     * kids that are direct objects in the template get a new object id on every fill, so id is only good when existing is set.
+     * page is the index of the page a widget sits on, -1 if unknown.
+     * it's plain data, no pdf objects or parser behind it, so any number of threads can fill from it at once
+     */
+    typedef struct field_node_t {
+      bool existing = false;
+      ObjectIDType id = 0;
+      bool parsed = false;
+      dictionary_entries_t entries;
+      bool hasName = false;
+      std::string fullName;
+      std::string fieldType;
+      long long flags = 0;
+      std::string da;
+      std::shared_ptr<const text_style_t> style;
+      long long q = 0;
+      long long maxLen = 0;
+      std::vector<std::string> opt;
+      bool isWidget = false;
+      bool appearanceInField = false;
+      bool hasRect = false;
+      PDFRectangle rect;
+      long page = -1;
+      std::shared_ptr<const appearance_t> appearance;
+      std::string onState;
+      std::vector<normal_appearance_t> normalAppearances;
+      std::string appearanceState;
+      long long annotationFlags = 0;
+      bool hasKids = false;
+      std::vector<field_node_t> kids;
+      // radio buttons with kids: the kid each export value turns on. that's the Opt entry of the kid when there's an
+      // Opt, and its on state either way
+      std::unordered_map<std::string, long> kidByExportValue;
+    } field_node_t;
+
+    /**
+     * a named field of the template, with where it sits in the tree and the widgets that show it
+     */
+    typedef struct {
+      const field_node_t* field;
+      std::vector<const field_node_t*> ancestors; // top level field first
+      std::vector<const field_node_t*> widgets;
+    } field_index_entry_t;
+
+    /**
+     * a widget to flatten, with the named field it belongs to. kid is its index in the field kids, -1 when the widget is
+     * the field itself
+     */
+    typedef struct {
+      const field_node_t* widget;
+      const field_node_t* field;
+      long kid;
+    } page_widget_t;
 
+    /**
+     * a page with widgets on it, as much of it as flattening needs to rewrite it: its entries, its resources (its own or
+     * inherited) with their XObjects, its Contents items and its Annots items. widgets are in Annots order, which is the
+     * order they're painted in
+     */
     typedef struct {
-      bool existing;
       ObjectIDType id;
-      PDFObject* field;
-    } field_ref_t;
+      dictionary_entries_t entries;
+      dictionary_entries_t resourceEntries;
+      dictionary_entries_t xobjectEntries;
+      std::vector<std::string> contents;
+      std::vector<std::pair<ObjectIDType, std::string>> annots;
+      std::vector<page_widget_t> widgets;
+    } page_t;
+
+    /**
+     * a template parsed once into a form model. fill it as many times as you like, each fill only writes its own
+     * incremental update. data/size is the pdf every fill modifies: the file bytes, owned in bytes, when loaded from a
+     * path, or a range the caller keeps alive (a buffer or a memory mapping) when loaded from memory.
+     * once built it's read only, so it can be shared between threads
+     */
+    class form_template_t {
+      public:
+        std::string bytes;
+        const char* data = NULL;
+        size_t size = 0;
+        InputByteArrayStream stream;
+        PDFParser parser;
+
+        ObjectIDType catalogId = 0;
+        dictionary_entries_t catalogEntries;
+        bool acroformIndirect = false;
+        ObjectIDType acroformId = 0;
+        dictionary_entries_t acroformEntries;
+        dictionary_entries_t drEntries;
+        // when DR is an object of its own, appearances can point at it as it is
+        ObjectIDType drId = 0;
+        bool hasFields = false;
+        std::vector<field_node_t> fields;
+
+        // every named field by its fully qualified name, in the order they appear in the form
+        std::vector<field_index_entry_t> fieldIndex;
+        std::unordered_map<std::string, size_t> fieldIndexByName;
+
+        // the pages with widgets on them, by page order
+        std::vector<page_t> pages;
+
+        // how many objects building this asked the parser for, and how many of those were already parsed. 0 for a
+        // template loaded with a plan
+        size_t objectLookups = 0;
+        size_t objectCacheHits = 0;
+
+        form_template_t() {}
+        form_template_t(const form_template_t&) = delete;
+        form_template_t& operator=(const form_template_t&) = delete;
+
+        const field_index_entry_t* findField(const std::string& name) const {
+          auto found = fieldIndexByName.find(name);
+          if(found == fieldIndexByName.end()) {
+            return NULL;
+          }
+          return &fieldIndex[found->second];
+        }
+    };
+
+    // hands out one record per call, along with the path to write it to. return false when there are no more
+    typedef std::function<bool(std::map<std::string, pdf_value_t>& data, std::string& outputPath)> record_source_t;
+
+    /**
+     * the index of the kid of a radio button an export value turns on, -1 for none of them. an index written out as
+     * a number works too, for export values that aren't numbers themselves
+     */
+    static long findExportValue(const field_node_t& field, const std::string& exportValue) {
+      auto found = field.kidByExportValue.find(exportValue);
+      if(found != field.kidByExportValue.end()) {
+        return found->second;
+      }
+
+      char* end;
+      long long index = strtoll(exportValue.c_str(), &end, 10);
+      if(exportValue.empty() || *end != 0 || index < 0 || index >= (long long)field.kids.size()) {
+        return -1;
+      }
+      return (long)index;
+    }
 
   private:
+    // scratch for reading templates. the objects parsed so far, the decoded appearance streams, and the one buffer
+    // they're all decoded into
+    pdf_form_object_cache objectCache;
+    std::unordered_map<ObjectIDType, std::shared_ptr<const appearance_t>> appearanceCache;
+    std::string streamBuffer;
+    // DR fonts by resource name, with their BaseFont, and the text style of every distinct DA string
+    std::unordered_map<std::string, std::pair<ObjectIDType, std::string>> drFonts;
+    std::unordered_map<std::string, std::shared_ptr<const text_style_t>> styleCache;
+    // where to look for local copies of the fonts DA strings name
+    std::string fontDirectory;
+    stats_hook_t statsHook;
+    // page index of every page object, and of every annotation listed in the Annots of the pages read so far. pages
+    // are only read as widgets point at them, all of them only once a widget turns up that none of those list
+    std::unordered_map<ObjectIDType, long> pageByObject;
+    std::unordered_map<ObjectIDType, long> pageByAnnotation;
+    std::unordered_set<long> annotatedPagesRead;
+    bool allAnnotatedPagesRead = false;
+
+    /**
+     * the appearance of a text widget, worked out before anything is written. key sums up everything the BBox, resources
+     * and content of the stream come out of, so two appearances with the same key write the very same bytes
+     */
+    typedef struct {
+      double boxWidth = 0;
+      double boxHeight = 0;
+      const appearance_t* original = NULL;
+      // laid out text, written with textOptions
+      bool laidOut = false;
+      AbstractContentContext::TextOptions textOptions = AbstractContentContext::TextOptions(NULL, 0, AbstractContentContext::eGray, 0);
+      pdf_form_layout::layout_t layout;
+      // or naive text, fontCode as a DA set in the DR font fontName when fontId isn't 0
+      ObjectIDType fontId = 0;
+      std::string fontName;
+      std::string fontCode;
+      std::string text;
+      std::string key;
+    } text_appearance_t;
+
+    /**
+     * the context of one fill. there's one per fill, and everything down the walk works on it by reference
+     */
+    typedef struct {
+      PDFWriter& writer;
+      ObjectsContext& objectsContext;
+      const std::map<std::string, pdf_value_t>& data;
+      const form_template_t& form;
+      const options_t& options;
+      // the fields that get a value, straight out of the index
+      std::unordered_map<const field_node_t*, const pdf_value_t*> values;
+      // minimal update only. fields that get a value, or have a descendant that does
+      std::unordered_set<const field_node_t*> dirty;
+      // fonts of text styles, loaded into this fill's document
+      std::unordered_map<const text_style_t*, PDFUsedFont*> usedFonts;
+      // appearance streams written so far, by their key
+      std::unordered_map<std::string, ObjectIDType> appearanceIds;
+      // appearances laid out ahead of the walk, by widget. see planAppearancesConcurrently
+      std::unordered_map<const field_node_t*, text_appearance_t> plannedAppearances;
+      // the resources every naive appearance points at, the DR. 0 till the first one is written
+      ObjectIDType resourcesId = 0;
+      fill_stats_t stats;
+    } handles_t;
+
+    /**
+     * what a field hands down to its kids. a scope only holds what its own field sets, lookups walk up the parents
+     */
+    typedef struct inherited_scope_t {
+      const inherited_scope_t* parent = NULL;
+      PDFObjectCastPtr<PDFName> ft;
+      PDFObjectCastPtr<PDFInteger> ff;
+      RefCountPtr<PDFObject> da;
+      PDFObjectCastPtr<PDFInteger> q;
+      PDFObjectCastPtr<PDFInteger> maxLen;
+      PDFObjectCastPtr<PDFArray> opt;
+    } inherited_scope_t;
+
     /**
      * a wonderfully reusable method to recreate a dict without all the keys that we want to change
      * note that it starts writing a dict, but doesn't finish it. your job
      */
-    DictionaryContext* startModifiedDictionary(handles_t handles, PDFObjectCastPtr<PDFDictionary> originalDict, std::vector<std::string> excludedKeys) {
+    DictionaryContext* startModifiedDictionary(handles_t& handles, const dictionary_entries_t& originalEntries, key_set_t excludedKeys) {
       DictionaryContext* newDict = handles.objectsContext.StartDictionary();
-
-      MapIterator<PDFNameToPDFObjectMap> it = originalDict->GetIterator();
-      PDFObjectCastPtr<PDFName> key;
-      PDFObject* value;
-
-      while(it.MoveNext()) {
-        key = it.GetKey();
-        value = it.GetValue();
-        if(std::find(excludedKeys.begin(), excludedKeys.end(), key->GetValue()) != excludedKeys.end()) {
-          continue;
+      IByteWriterWithPosition* stream = handles.objectsContext.StartFreeContext();
+      const std::string& bytes = originalEntries.bytes;
+
+      // copy the runs of entries in between the dropped ones. usually that's one or two writes for the whole dictionary
+      size_t start = 0;
+      if((originalEntries.keys & excludedKeys) != 0) {
+        for(const dictionary_entry_t& entry : originalEntries.entries) {
+          if((entry.keyBit & excludedKeys) == 0) {
+            continue;
+          }
+          if(entry.offset > start) {
+            stream->Write((const IOBasicTypes::Byte*)bytes.data() + start, entry.offset - start);
+          }
+          start = entry.offset + entry.size;
         }
-
-        newDict->WriteKey(key->GetValue());
-        handles.copyingContext->CopyDirectObjectAsIs(value);
       }
+      if(start < bytes.size()) {
+        stream->Write((const IOBasicTypes::Byte*)bytes.data() + start, bytes.size() - start);
+      }
+
+      handles.objectsContext.EndFreeContext();
       return newDict;
     }
 
-    void defaultTerminalFieldWrite(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary) {
+    /**
+     * start the object of a field that's about to be rewritten. existing ones get modified, direct ones become new objects
+     */
+    void startFieldObject(handles_t& handles, const field_node_t& field, ObjectIDType id) {
+      if(field.existing) {
+        handles.objectsContext.StartModifiedIndirectObject(id);
+      } else {
+        handles.objectsContext.StartNewIndirectObject(id);
+      }
+    }
+
+    void defaultTerminalFieldWrite(handles_t& handles, const field_node_t& field) {
       // default write of ending field. no reason to recurse to kids
-      handles.copyingContext->CopyDirectObjectAsIs(fieldDictionary.GetPtr());
+      DictionaryContext* fieldDict = startModifiedDictionary(handles, field.entries, 0);
+      handles.objectsContext.EndDictionary(fieldDict);
       handles.objectsContext.EndIndirectObject();
     }
 
     /**
-     * Update radio button value. look for the field matching the value, which should be an index.
-     * Set its ON appearance as the value, and set all radio buttons appearance to off, but the selected one which should be on
+     * the name of the "on" appearance of a checkbox or radio widget. that's whichever normal appearance isn't Off
      */
-    void updateOptionButtonValue(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary, pdf_value_t value) {
-      bool isWidget = false;
-      PDFObjectCastPtr<PDFName> subtype = fieldDictionary->QueryDirectObject("Subtype");
-      isWidget = (subtype != NULL && subtype->GetValue() == "Widget");
+    std::string getOnAppearanceName(PDFObjectCastPtr<PDFDictionary> widgetDictionary) {
+      PDFObjectCastPtr<PDFDictionary> apDictionary = objectCache.query(widgetDictionary.GetPtr(), "AP");
+      if(apDictionary == NULL) {
+        return "";
+      }
+
+      PDFObjectCastPtr<PDFDictionary> nAppearances = objectCache.query(apDictionary.GetPtr(), "N");
+      if(nAppearances == NULL) {
+        return "";
+      }
+
+      MapIterator<PDFNameToPDFObjectMap> it = nAppearances->GetIterator();
+      while(it.MoveNext()) {
+        if(it.GetKey()->GetValue() != "Off") {
+          return it.GetKey()->GetValue();
+        }
+      }
+      return "";
+    }
+
+    /**
+     * index the kids of a radio button by their export values. Opt entries go first, so an export value that's also
+     * the on state of another kid still picks the kid Opt gives it
+     */
+    static void indexExportValues(field_node_t& field) {
+      field.kidByExportValue.clear();
+      if(field.fieldType != "Btn" || ((field.flags >> 15) & 1) == 0 || field.isWidget || !field.hasKids) {
+        return;
+      }
 
+      for(size_t i = 0; i < field.kids.size() && i < field.opt.size(); i++) {
+        if(field.kids[i].parsed) {
+          field.kidByExportValue.emplace(field.opt[i], (long)i);
+        }
+      }
+      for(size_t i = 0; i < field.kids.size(); i++) {
+        if(field.kids[i].parsed && !field.kids[i].onState.empty()) {
+          field.kidByExportValue.emplace(field.kids[i].onState, (long)i);
+        }
+      }
+    }
 
-      if (isWidget || fieldDictionary->Exists("Kids") == false) {
+    /**
+     * Update radio button value. look for the field matching the value, which should be an index.
+     * Set its ON appearance as the value, and set all radio buttons appearance to off, but the selected one which should be on
+     */
+    void updateOptionButtonValue(handles_t& handles, const field_node_t& field, const pdf_value_t& value) {
+      if (field.isWidget || !field.hasKids) {
         // this radio button has just one option and its in the widget. also means no kids
-        DictionaryContext* modifiedDict = startModifiedDictionary(handles, fieldDictionary, { "V", "AS" });
+        DictionaryContext* modifiedDict = startModifiedDictionary(handles, field.entries, KEY_V | KEY_AS);
         std::string appearanceName;
-        if (value.type() == "none") {
+        if (value.type() == pdf_value_t::NONE) {
           // false is easy, just write '/Off' as the value and as the appearance stream
           appearanceName = "Off";
         } else {
           // grab the non off value. that should be the yes one
-          PDFObjectCastPtr<PDFDictionary> apDictionary = handles.reader.QueryDictionaryObject(fieldDictionary.GetPtr(), "AP");
-          PDFObjectCastPtr<PDFDictionary> nAppearances = handles.reader.QueryDictionaryObject(apDictionary.GetPtr(), "N");
-          MapIterator<PDFNameToPDFObjectMap> it = nAppearances->GetIterator();
-          PDFObjectCastPtr<PDFName> key;
-          while(it.MoveNext()) {
-            key = it.GetKey();
-            if(key->GetValue() != "Off") {
-              appearanceName = key->GetValue();
-              break;
-            }
-          }
+          appearanceName = field.onState;
         }
 
         modifiedDict->WriteKey("V");
@@ -500,27 +774,16 @@ class pdf_form_fill {
         handles.objectsContext.EndIndirectObject();
       } else {
         // Field. this would mean that there's a kid array, and there are offs and ons to set
-        DictionaryContext* modifiedDict = startModifiedDictionary(handles, fieldDictionary, {"V", "Kids"});
-        PDFObjectCastPtr<PDFArray> kidsArray = handles.reader.QueryDictionaryObject(fieldDictionary.GetPtr(), "Kids");
+        DictionaryContext* modifiedDict = startModifiedDictionary(handles, field.entries, KEY_V | KEY_KIDS);
+        long long selected = value.ToInteger();
 
         std::string appearanceName;
-        if (value.ToString() == "none") {
+        if (value.type() == pdf_value_t::NONE || selected < 0 || selected >= (long long)field.kids.size() || !field.kids[selected].parsed) {
           // false is easy, just write '/Off' as the value and as the appearance stream
           appearanceName = "Off";
         } else {
           // grab the non off value. that should be the yes one
-          PDFObjectCastPtr<PDFDictionary> widgetDictionary = handles.reader.QueryArrayObject(kidsArray.GetPtr(), value.ToInteger());
-          PDFObjectCastPtr<PDFDictionary> apDictionary = handles.reader.QueryDictionaryObject(widgetDictionary.GetPtr(), "AP");
-          PDFObjectCastPtr<PDFDictionary> nAppearances = handles.reader.QueryDictionaryObject(apDictionary.GetPtr(), "N");
-          MapIterator<PDFNameToPDFObjectMap> it  = nAppearances->GetIterator();
-          PDFObjectCastPtr<PDFName> key;
-          while(it.MoveNext()) {
-            key = it.GetKey();
-            if(key->GetValue() != "Off") {
-              appearanceName = key->GetValue();
-              break;
-            }
-          }
+          appearanceName = field.kids[selected].onState;
         }
 
         // set the V value on the new field dictionary
@@ -531,25 +794,20 @@ class pdf_form_fill {
         modifiedDict->WriteKey("Kids");
 
         // write the kids array, similar to writeFilledFields, but knowing that these are widgets and that AS needs to be set
-        std::vector<field_ref_t> fieldsReferences = writeKidsAndEndObject(handles, modifiedDict, kidsArray);
+        std::vector<ObjectIDType> kidIds = writeKidsAndEndObject(handles, modifiedDict, field.kids);
 
         // recreate widget kids, turn on or off based on their relation to the target value
-        for(size_t i = 0; i < fieldsReferences.size(); i++) {
-          field_ref_t fieldReference = fieldsReferences[i];
-          PDFObjectCastPtr<PDFDictionary> sourceField = NULL;
-
-          if(fieldReference.existing) {
-            handles.objectsContext.StartModifiedIndirectObject(fieldReference.id);
-            sourceField = handles.reader.ParseNewObject(fieldReference.id);
-          } else {
-            handles.objectsContext.StartNewIndirectObject(fieldReference.id);
-            sourceField = fieldReference.field;
+        for(size_t i = 0; i < field.kids.size(); i++) {
+          const field_node_t& kid = field.kids[i];
+          if(!kid.parsed) {
+            continue;
           }
 
-          DictionaryContext* modifiedFieldDict = startModifiedDictionary(handles, sourceField, { "AS" });
-          if (value.ToInteger() == i) {
+          startFieldObject(handles, kid, kidIds[i]);
+          DictionaryContext* modifiedFieldDict = startModifiedDictionary(handles, kid.entries, KEY_AS);
+          if (selected == (long long)i) {
             // this widget should be on
-            modifiedFieldDict->WriteKey("AS"); //doen
+            modifiedFieldDict->WriteKey("AS");
             modifiedFieldDict->WriteNameValue(appearanceName); // note that we have saved it earlier
           } else {
             // this widget should be off
@@ -563,297 +821,494 @@ class pdf_form_fill {
       }
     }
 
-    std::string getOriginalTextFieldAppearanceStreamCode(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary) {
-      // get the single appearance stream for the text, field. we'll use it to recreate the new one
-      bool appearanceInField = fieldDictionary->Exists("Subtype");
-      if(appearanceInField) {
-        bool is_widget;
-        PDFObjectCastPtr<PDFName> subtype = fieldDictionary->QueryDirectObject("Subtype");
-        appearanceInField = (subtype->GetValue() == "Widget" || !fieldDictionary->Exists("Kids"));
-      }
-
-      PDFObjectCastPtr<PDFDictionary> appearanceParent = NULL;
-      if(appearanceInField) {
-        appearanceParent = fieldDictionary;
-      } else {
-        if(fieldDictionary->Exists("Kids")) {
-          PDFObjectCastPtr<PDFArray> kidsArray = handles.reader.QueryDictionaryObject(fieldDictionary.GetPtr(), "Kids");
-          if(kidsArray->GetLength() > 0) {
-            appearanceParent = handles.reader.QueryArrayObject(kidsArray.GetPtr(), 0);
-          }
+    std::shared_ptr<const appearance_t> getOriginalTextFieldAppearance(PDFParser& reader, PDFObjectCastPtr<PDFDictionary> widgetDictionary) {
+      // get the single appearance stream of the widget. we'll use it to recreate the new one
+      PDFObjectCastPtr<PDFDictionary> appearance = objectCache.query(widgetDictionary.GetPtr(), "AP");
+      if(appearance == NULL || !appearance->Exists("N"))
+        return NULL;
+
+      // streams are always indirect, and widgets of the same field often point at the very same one
+      PDFObjectCastPtr<PDFIndirectObjectReference> appearanceReference = appearance->QueryDirectObject("N");
+      if(appearanceReference != NULL) {
+        auto cached = appearanceCache.find(appearanceReference->mObjectID);
+        if(cached != appearanceCache.end()) {
+          return cached->second;
         }
       }
 
-      if(!appearanceParent) {
-        return _NULL_;
-      }
-
-      if(!appearanceParent->Exists("AP"))
-        return _NULL_;
+      PDFObjectCastPtr<PDFStreamInput> appearanceXObject = objectCache.query(appearance.GetPtr(), "N");
+      if(appearanceXObject == NULL)
+        return NULL;
 
-      PDFObject* m =  handles.reader.QueryDictionaryObject(appearanceParent.GetPtr(), "AP");
-      PDFObjectCastPtr<PDFDictionary> appearance = handles.reader.QueryDictionaryObject(appearanceParent.GetPtr(), "AP");
-      if(!appearance->Exists("N"))
-        return _NULL_;
-
-      PDFObjectCastPtr<PDFStreamInput> appearanceXObject = handles.reader.QueryDictionaryObject(appearance.GetPtr(), "N");
-      return readStreamToString(handles, appearanceXObject);
+      readStream(reader, appearanceXObject, streamBuffer);
+      std::shared_ptr<const appearance_t> split = splitTextAppearance(streamBuffer);
+      if(appearanceReference != NULL) {
+        appearanceCache[appearanceReference->mObjectID] = split;
+      }
+      return split;
     }
 
-    void writeAppearanceXObjectForText(handles_t handles, ObjectIDType formId, PDFObjectCastPtr<PDFDictionary> fieldsDictionary, pdf_value_t text, std::map<std::string, pdf_value_t> inheritedProperties) {
-      PDFObjectCastPtr<PDFArray> rect = handles.reader.QueryDictionaryObject(fieldsDictionary.GetPtr(), "Rect");
-
-      PDFObjectCastPtr<PDFName> _da;
-      std::string da;
-      if((_da = fieldsDictionary->QueryDirectObject("DA")) != NULL) {
-        da = _da->GetValue();
+    /**
+     * split an appearance stream around its marked text. without one, the whole stream goes before the new text
+     */
+    std::shared_ptr<const appearance_t> splitTextAppearance(std::string_view content) {
+      static const std::string_view lookfor_bmc = "/Tx BMC";
+      static const std::string_view lookfor_emc = "EMC";
+
+      std::shared_ptr<appearance_t> split = std::make_shared<appearance_t>();
+      size_t pre = content.find(lookfor_bmc);
+      if(pre != std::string_view::npos) {
+        split->before = content.substr(0, pre);
+        size_t post = content.find(lookfor_emc, pre + lookfor_bmc.size());
+        if(post != std::string_view::npos) {
+          split->after = content.substr(post + lookfor_emc.size());
+        }
       } else {
-        da = inheritedProperties["DA"].ToString();
+        split->before = content;
       }
+      return split;
+    }
 
-      PDFObjectCastPtr<PDFInteger> _q;
-      long long q;
-      if((_q = fieldsDictionary->QueryDirectObject("Q")) != NULL) {
-        q = _q->GetValue();
-      } else {
-        q = inheritedProperties["Q"].ToInteger();
+    /**
+     * the appearance of a widget showing text. taken from planAppearancesConcurrently when it laid it out already
+     */
+    text_appearance_t planTextAppearance(handles_t& handles, const field_node_t& widget, const pdf_value_t& text) {
+      std::string value = text.ToString();
+      auto planned = handles.plannedAppearances.find(&widget);
+      if(planned != handles.plannedAppearances.end() && planned->second.text == value) {
+        return std::move(planned->second);
       }
 
+      PDF_FORM_TIMER(handles.stats.layoutMicros);
+      return layoutTextAppearance(handles, widget, value);
+    }
+
+    /**
+     * work out the appearance of a widget. it only reads handles once the fonts it needs are loaded (see getUsedFont),
+     * which planAppearancesConcurrently relies on
+     */
+    text_appearance_t layoutTextAppearance(handles_t& handles, const field_node_t& widget, const std::string& text) {
+      long long q = widget.q;
+
       if(handles.options.debug) {
         printf("creating new appearance with:\n");
-          printf("da = %s\n", da.c_str());
+          printf("da = %s\n", widget.da.c_str());
           printf("q = %lli\n", q);
           //printf("fieldsDictionary =", fieldsDictionary.toJSObject());
           //printf("inheritedProperties =", inheritedProperties);
-          printf("text = %s\n", text.ToString().c_str());
+          printf("text = %s\n", text.c_str());
       }
 
-      std::string originalAppearanceContent = getOriginalTextFieldAppearanceStreamCode(handles, fieldsDictionary);
-      std::string before = "";
-      std::string after = "";
+      text_appearance_t appearance;
+      appearance.boxWidth = widget.rect.UpperRightX - widget.rect.LowerLeftX;
+      appearance.boxHeight = widget.rect.UpperRightY - widget.rect.LowerLeftY;
+      appearance.original = widget.appearance.get();
+      appearance.text = text;
 
-      std::string lookfor_bmc = "/Tx BMC";
-      std::string lookfor_emc = "EMC";
-
-      if(originalAppearanceContent != _NULL_) {
-        size_t pre = originalAppearanceContent.find(lookfor_bmc);
-          if(pre != std::string::npos) {
-            before = originalAppearanceContent.substr(0, pre);
-            size_t post = originalAppearanceContent.find(lookfor_emc, pre + lookfor_bmc.size());
-              if(post != std::string::npos) {
-                after = originalAppearanceContent.substr(post + lookfor_emc.size());
-              }
-          } else {
-            before = originalAppearanceContent;
-          }
+      // If default text options setup, use them to determine the text appearance. including quad support, horizontal centering etc.
+      // Otherwise go by the DA. its font gets written with a local copy of the font when there's one, or referenced out
+      // of /DR as is. the latter is the naive method: Tj with "code" encoding, assuming encoding should work (??), and
+      // no Quad support as there's nothing to measure with
+      AbstractContentContext::TextOptions* textOptions = handles.options.defaultTextOptions;
+      const pdf_form_font* metrics = handles.options.defaultFontMetrics;
+      const text_style_t* style = widget.style.get();
+
+      AbstractContentContext::TextOptions styleOptions(NULL, 0, AbstractContentContext::eGray, 0);
+      if(textOptions == NULL && style != NULL && !style->fontPath.empty()) {
+        styleOptions.font = getUsedFont(handles, *style);
+        if(styleOptions.font != NULL) {
+          styleOptions.fontSize = style->fontSize;
+          styleOptions.colorSpace = style->colorSpace;
+          styleOptions.colorValue = style->colorValue;
+          textOptions = &styleOptions;
+          metrics = style->metrics;
+        }
       }
 
-      double upper_right_x = 0.0;
-      double lower_left_x = 0.0;
-      double upper_right_y = 0.0;
-      double lower_left_y = 0.0;
+      char identity[64];
+      snprintf(identity, sizeof(identity), "%p ", (const void*)appearance.original);
+      appearance.key = pdf_form_serialize::formatNumber(appearance.boxWidth) + " " + pdf_form_serialize::formatNumber(appearance.boxHeight) + " " + identity;
+
+      if(textOptions != NULL) {
+        // lay the text out per the field flags: multiline (bit 13) wraps, comb (bit 25) spreads MaxLen cells. size 0 fits the box
+        pdf_form_layout::measured_text_t measured = metrics != NULL ?
+          pdf_form_layout::measure(*metrics, appearance.text) :
+          measureWithUsedFont(textOptions->font, appearance.text);
+        pdf_form_layout::box_t box = {
+          appearance.boxWidth,
+          appearance.boxHeight,
+          textOptions->fontSize,
+          q,
+          ((widget.flags >> 12) & 1) != 0,
+          ((widget.flags >> 24) & 1) != 0,
+          widget.maxLen
+        };
+
+        appearance.laidOut = true;
+        appearance.layout = pdf_form_layout::layoutText(measured, box);
+        appearance.textOptions = *textOptions;
+        appearance.textOptions.fontSize = appearance.layout.fontSize;
 
-      PDFObject* t;
-      t = handles.reader.QueryArrayObject(rect.GetPtr(), 0);
-      if(t->GetType() == PDFDictionary::ePDFObjectInteger) {
-        lower_left_x = ((PDFObjectCastPtr<PDFInteger>)t)->GetValue();
+        snprintf(identity, sizeof(identity), "%p %d %lu ", (const void*)textOptions->font, (int)textOptions->colorSpace, textOptions->colorValue);
+        appearance.key += std::string("laid out ") + identity + pdf_form_serialize::formatNumber(appearance.layout.fontSize);
+        for(const pdf_form_layout::line_t& line : appearance.layout.lines) {
+          appearance.key += " " + pdf_form_serialize::formatNumber(line.x) + " " + pdf_form_serialize::formatNumber(line.y) + " " + std::to_string(line.text.size()) + ":" + line.text;
+        }
+      } else {
+        // Naive form, no quad support...and text may not show and may be mispositioned
+        appearance.fontCode = widget.da;
+        if(style != NULL && style->fontId != 0) {
+          // set in the /DR font the DA names, the appearance takes its resources from the DR. an auto size gets one that fits
+          appearance.fontId = style->fontId;
+          appearance.fontName = style->fontName;
+          double fontSize = style->fontSize > 0 ? style->fontSize : pdf_form_layout::fitToHeight(appearance.boxHeight, 1);
+          appearance.fontCode = pdf_form_serialize::formatNumber(fontSize) + " Tf " + style->colorCode;
+        }
 
-      } else if(t->GetType() == PDFDictionary::ePDFObjectReal){
-        lower_left_x = ((PDFObjectCastPtr<PDFReal>)t)->GetValue();
+        appearance.key += "naive " + std::to_string(appearance.fontId) + " " + std::to_string(appearance.fontName.size()) + ":" + appearance.fontName +
+          " " + std::to_string(appearance.fontCode.size()) + ":" + appearance.fontCode +
+          " " + appearance.text;
       }
+      return appearance;
+    }
 
-      t = handles.reader.QueryArrayObject(rect.GetPtr(), 1);
-      if(t->GetType() == PDFDictionary::ePDFObjectInteger) {
-        lower_left_y = ((PDFObjectCastPtr<PDFInteger>)t)->GetValue();
+    /**
+     * whether a widget can be laid out off the writing thread. measuring with a document font (when there are no cached
+     * metrics for it) goes through freetype, which isn't thread safe, so those are left to the walk
+     */
+    bool canPlanConcurrently(handles_t& handles, const field_node_t& widget) {
+      if(handles.options.defaultTextOptions != NULL) {
+        return handles.options.defaultFontMetrics != NULL;
+      }
 
-      } else if(t->GetType() == PDFDictionary::ePDFObjectReal){
-        lower_left_y = ((PDFObjectCastPtr<PDFReal>)t)->GetValue();
+      const text_style_t* style = widget.style.get();
+      if(style == NULL || style->fontPath.empty()) {
+        return true;
       }
+      return style->metrics != NULL;
+    }
+
+    /**
+     * lay out the text appearances of every widget that gets a value on options.appearanceThreads threads, before
+     * anything is written. object ids and the streams themselves are still taken and written by the walk, in the order
+     * it always does, and writing the text has to encode it with the document fonts, which stays on the writing thread.
+     * so the output is the same byte for byte as without threads. the fonts are loaded here first, loading one touches
+     * the document
+     */
+    void planAppearancesConcurrently(handles_t& handles) {
+      static const size_t MIN_APPEARANCES = 64;
+      static const size_t APPEARANCES_PER_TAKE = 16;
+
+      std::vector<std::pair<const field_node_t*, std::string>> work;
+      for(const auto& item : handles.data) {
+        const field_index_entry_t* entry = handles.form.findField(item.first);
+        if(entry == NULL || (entry->field->fieldType != "Tx" && entry->field->fieldType != "Ch")) {
+          continue;
+        }
 
-      t = handles.reader.QueryArrayObject(rect.GetPtr(), 2);
-      if(t->GetType() == PDFDictionary::ePDFObjectInteger) {
-        upper_right_x = ((PDFObjectCastPtr<PDFInteger>)t)->GetValue();
+        std::string text = entry->field->fieldType == "Tx" ? item.second.ToString() : getChoiceText(item.second);
+        for(const field_node_t* widget : entry->widgets) {
+          if(!canPlanConcurrently(handles, *widget)) {
+            continue;
+          }
+          if(handles.options.defaultTextOptions == NULL && widget->style != NULL && !widget->style->fontPath.empty()) {
+            getUsedFont(handles, *widget->style);
+          }
+          work.push_back(std::make_pair(widget, text));
+        }
+      }
 
-      } else if(t->GetType() == PDFDictionary::ePDFObjectReal){
-        upper_right_x = ((PDFObjectCastPtr<PDFReal>)t)->GetValue();
+      if(work.size() < MIN_APPEARANCES) {
+        // not worth starting threads for
+        return;
       }
 
-      t = handles.reader.QueryArrayObject(rect.GetPtr(), 3);
-      if(t->GetType() == PDFDictionary::ePDFObjectInteger) {
-        upper_right_y = ((PDFObjectCastPtr<PDFInteger>)t)->GetValue();
+      size_t threadCount = std::min<size_t>(handles.options.appearanceThreads, (work.size() + APPEARANCES_PER_TAKE - 1) / APPEARANCES_PER_TAKE);
+      std::vector<text_appearance_t> planned(work.size());
+      std::vector<double> layoutMicros(threadCount, 0);
+      std::atomic<size_t> next(0);
+
+      auto plan = [&]([[maybe_unused]] size_t thread) {
+        size_t start;
+        while((start = next.fetch_add(APPEARANCES_PER_TAKE)) < work.size()) {
+          size_t end = std::min(work.size(), start + APPEARANCES_PER_TAKE);
+          for(size_t i = start; i < end; i++) {
+            PDF_FORM_TIMER(layoutMicros[thread]);
+            planned[i] = layoutTextAppearance(handles, *work[i].first, work[i].second);
+          }
+        }
+      };
 
-      } else if(t->GetType() == PDFDictionary::ePDFObjectReal){
-        upper_right_y = ((PDFObjectCastPtr<PDFReal>)t)->GetValue();
+      std::vector<std::thread> threads;
+      for(size_t i = 1; i < threadCount; i++) {
+        threads.push_back(std::thread(plan, i));
+      }
+      plan(0);
+      for(std::thread& thread : threads) {
+        thread.join();
       }
 
-      double boxWidth = upper_right_x - lower_left_x;
-      double boxHeight = upper_right_y - lower_left_y;
+      for(size_t i = 0; i < threadCount; i++) {
+        handles.stats.layoutMicros += layoutMicros[i];
+      }
+      handles.plannedAppearances.reserve(work.size());
+      for(size_t i = 0; i < work.size(); i++) {
+        handles.plannedAppearances[work[i].first] = std::move(planned[i]);
+      }
+    }
 
-      PDFFormXObject* xobjectForm = handles.writer.StartFormXObject(PDFRectangle(0, 0, boxWidth, boxHeight), formId);
+    /**
+     * the object id for an appearance. identical appearances of the same document share a single stream,
+     * fresh tells whether this is the first of its kind, and still has to be written
+     */
+    ObjectIDType getTextAppearanceId(handles_t& handles, const text_appearance_t& appearance, bool& fresh) {
+      auto found = handles.appearanceIds.find(appearance.key);
+      if(found != handles.appearanceIds.end()) {
+        fresh = false;
+        handles.stats.appearancesShared++;
+        return found->second;
+      }
 
-      // If default text options setup, use them to determine the text appearance. including quad support, horizontal centering etc.
-      // Otherwise, use naive method: Will use Tj with "code" encoding to write the text, assuming encoding should work (??). if it won't i need real fonts here
-      // and DA is not gonna be useful. so for now let's use as is.
-      // For the same reason i'm not support Quad, as well
+      fresh = true;
+      handles.stats.appearancesGenerated++;
+      ObjectIDType formId = handles.objectsContext.GetInDirectObjectsRegistry().AllocateNewObjectID();
+      handles.appearanceIds[appearance.key] = formId;
+      return formId;
+    }
 
-      // Should be able to parse the following from the DA, and map to system font
-      // temporarily, let user input the values
-      AbstractContentContext::TextOptions* textOptions = handles.options.defaultTextOptions;
+    void writeAppearanceXObjectForText(handles_t& handles, ObjectIDType formId, const text_appearance_t& appearance) {
+      PDF_FORM_TIMER(handles.stats.appearanceWriteMicros);
+      static const appearance_t noAppearance;
+      const std::string& before = appearance.original != NULL ? appearance.original->before : noAppearance.before;
+      const std::string& after = appearance.original != NULL ? appearance.original->after : noAppearance.after;
 
-      if(textOptions != NULL) {
-        // grab text dimensions for quad support and vertical centering
-        PDFUsedFont::TextMeasures textDimensions = textOptions->font->CalculateTextDimensions(text.ToString(), textOptions->fontSize);
-
-        // vertical centering
-        double yPos = (boxHeight - textDimensions.height) / 2;
-        // horizontal pos per quad
-        long long quad = q || 0;
-
-        double xPos = 0;
-        switch(quad) {
-          case 0:
-            // left align
-            xPos = 0;
-            break;
-          case 1:
-            // center
-            xPos = (boxWidth - textDimensions.width) / 2;
-            break;
-          case 2:
-            // right align
-            xPos = (boxWidth - textDimensions.width);
-        }
-
-        XObjectContentContext* xobjectFormContext = xobjectForm->GetContentContext();
-          xobjectFormContext->WriteFreeCode(before);
-          xobjectFormContext->WriteFreeCode("/Tx BMC\r\n");
-          xobjectFormContext->q();
-          xobjectFormContext->WriteText(xPos, yPos, text.ToString(), *textOptions);
-          xobjectFormContext->Q();
-          xobjectFormContext->WriteFreeCode("EMC");
-          xobjectFormContext->WriteFreeCode(after);;
-      } else {
-        // Naive form, no quad support...and text may not show and may be mispositioned
-        XObjectContentContext* xobjectFormContext = xobjectForm->GetContentContext();
-        xobjectFormContext->WriteFreeCode(before);
-        xobjectFormContext->WriteFreeCode("/Tx BMC\r\n");
-        xobjectFormContext->q();
-        xobjectFormContext->BT();
-        xobjectFormContext->WriteFreeCode(da + "\r\n");
-        xobjectFormContext->Tj(text.ToString());
-        xobjectFormContext->ET();
-        xobjectFormContext->Q();
-        xobjectFormContext->WriteFreeCode("EMC");
-        xobjectFormContext->WriteFreeCode(after);
-      }
-
-      if(handles.acroformDict->Exists("DR")) {
-        // copy all but the keys that exist already
-        PDFObjectCastPtr<PDFDictionary> dr = handles.reader.QueryDictionaryObject(handles.acroformDict.GetPtr(), "DR");
-
-        MapIterator<PDFNameToPDFObjectMap> it = dr->GetIterator();
-        RefCountPtr<PDFName> key;
-        PDFObject* value;
-        DictionaryContext* page_out_dic = handles.writer.GetObjectsContext().StartDictionary();
-        while(it.MoveNext()) {
-          key = it.GetKey();
-          value = it.GetValue();
-          if(key->GetValue() != "ProcSet" && (textOptions == NULL || key->GetValue() != "Font")) {
-            page_out_dic->WriteKey(key->GetValue());
-            handles.copyingContext->CopyDirectObjectAsIs(value);
-          }
+      if(!appearance.laidOut) {
+        writeNaiveAppearanceXObject(handles, formId, appearance, before, after);
+        return;
+      }
+
+      // laid out text is set in a font file of the document, which PDFHummus maps into resources of the form's own
+      PDFFormXObject* xobjectForm = handles.writer.StartFormXObject(PDFRectangle(0, 0, appearance.boxWidth, appearance.boxHeight), formId);
+      XObjectContentContext* xobjectFormContext = xobjectForm->GetContentContext();
+
+      xobjectFormContext->WriteFreeCode(before);
+      xobjectFormContext->WriteFreeCode("/Tx BMC\r\n");
+      xobjectFormContext->q();
+      for(const pdf_form_layout::line_t& line : appearance.layout.lines) {
+        if(!line.text.empty()) {
+          xobjectFormContext->WriteText(line.x, line.y, line.text, appearance.textOptions);
         }
       }
+      xobjectFormContext->Q();
+      xobjectFormContext->WriteFreeCode("EMC");
+      xobjectFormContext->WriteFreeCode(after);
 
       handles.writer.EndFormXObject(xobjectForm);
     }
 
+    /**
+     * the DR of the form as an object, for appearances to take their resources from. the template's own when DR is an
+     * object of its own, or else a copy of it, written once per document. 0 when the form has no DR
+     */
+    ObjectIDType getAppearanceResourcesId(handles_t& handles) {
+      if(handles.resourcesId == 0) {
+        handles.resourcesId = handles.form.drId;
+      }
+      if(handles.resourcesId != 0 || handles.form.drEntries.bytes.empty()) {
+        return handles.resourcesId;
+      }
+
+      handles.resourcesId = handles.objectsContext.StartNewIndirectObject();
+      DictionaryContext* resources = startModifiedDictionary(handles, handles.form.drEntries, 0);
+      handles.objectsContext.EndDictionary(resources);
+      handles.objectsContext.EndIndirectObject();
+      return handles.resourcesId;
+    }
+
+    /**
+     * an appearance of text set in a DA, as is. its font comes out of the DR, which the stream points at for its
+     * resources, so all of them share the one dictionary rather than each carrying its own
+     */
+    void writeNaiveAppearanceXObject(handles_t& handles, ObjectIDType formId, const text_appearance_t& appearance, const std::string& before, const std::string& after) {
+      ObjectIDType resourcesId = getAppearanceResourcesId(handles);
+
+      std::string content = before;
+      content += "/Tx BMC\r\nq\r\nBT\r\n";
+      if(appearance.fontId != 0) {
+        content += "/" + appearance.fontName + " ";
+      }
+      content += appearance.fontCode + "\r\n";
+      pdf_form_serialize::appendLiteralString(appearance.text, content);
+      content += " Tj\r\nET\r\nQ\r\nEMC";
+      content += after;
+
+      handles.objectsContext.StartNewIndirectObject(formId);
+      DictionaryContext* formDict = handles.objectsContext.StartDictionary();
+      formDict->WriteKey("Type");
+      formDict->WriteNameValue("XObject");
+      formDict->WriteKey("Subtype");
+      formDict->WriteNameValue("Form");
+      formDict->WriteKey("FormType");
+      formDict->WriteIntegerValue(1);
+      formDict->WriteKey("BBox");
+      formDict->WriteRectangleValue(PDFRectangle(0, 0, appearance.boxWidth, appearance.boxHeight));
+      if(resourcesId != 0) {
+        formDict->WriteKey("Resources");
+        formDict->WriteObjectReferenceValue(resourcesId);
+      }
+
+      PDFStream* stream = handles.objectsContext.StartPDFStream(formDict);
+      stream->GetWriteStream()->Write((const IOBasicTypes::Byte*)content.data(), content.size());
+      handles.objectsContext.EndPDFStream(stream);
+      delete stream;
+    }
+
+    /**
+     * the font of a text style, loaded into the document once per fill
+     */
+    PDFUsedFont* getUsedFont(handles_t& handles, const text_style_t& style) {
+      auto found = handles.usedFonts.find(&style);
+      if(found != handles.usedFonts.end()) {
+        return found->second;
+      }
+
+      PDF_FORM_TIMER(handles.stats.fontMicros);
+      PDFUsedFont* usedFont = handles.writer.GetFontForFile(style.fontPath);
+      handles.usedFonts[&style] = usedFont;
+      return usedFont;
+    }
+
+    /**
+     * measure text for layout with the document font itself, for when there are no cached metrics for it.
+     * a freetype call per character, and the ascent and descent are read off the extent of "Hg"
+     */
+    pdf_form_layout::measured_text_t measureWithUsedFont(PDFUsedFont* font, const std::string& text) {
+      pdf_form_layout::measured_text_t measured;
+      measured.text = text;
+
+      PDFUsedFont::TextMeasures extent = font->CalculateTextDimensions("Hg", 1000);
+      measured.ascent = extent.yMax / 1000;
+      measured.descent = extent.yMin / 1000;
+
+      for(size_t i = 0; i < text.size(); ) {
+        size_t start = i;
+        pdf_form_font::nextCodePoint(text, i);
+        measured.offsets.push_back(start);
+        measured.advances.push_back(font->CalculateTextAdvance(text.substr(start, i - start), 1));
+      }
+      measured.offsets.push_back(text.size());
+      return measured;
+    }
+
     #define BUFFER_SIZE 10000
-    std::string readStreamToString(handles_t handles, PDFObjectCastPtr<PDFStreamInput> stream) {
-      Byte readData[BUFFER_SIZE];
-      std::string buff = "";
-      IByteReader* readStream = handles.reader.StartReadingFromStream(stream.GetPtr());
+    /**
+     * decode a stream into buffer, replacing what's there. content streams are bytes, not text, so they're kept as is.
+     * reads straight into the buffer, which keeps its capacity from one stream to the next
+     */
+    void readStream(PDFParser& reader, PDFObjectCastPtr<PDFStreamInput> stream, std::string& buffer) {
+      buffer.clear();
+      IByteReader* readStream = reader.StartReadingFromStream(stream.GetPtr());
+      if(readStream == NULL) {
+        return;
+      }
 
+      size_t size = 0;
       while(readStream->NotEnded()) {
-        IOBasicTypes::LongBufferSizeType read = readStream->Read(readData, BUFFER_SIZE);
-        for(IOBasicTypes::LongBufferSizeType i = 0; i < read; i++) {
-          UnicodeString u;
-          u.FromUTF16((char*)readData);
-          EStatusCodeAndString result = u.ToUTF8();
-          buff += result.second;
-        }
+        buffer.resize(size + BUFFER_SIZE);
+        size += readStream->Read((IOBasicTypes::Byte*)&buffer[size], BUFFER_SIZE);
       }
-      return buff;
+      buffer.resize(size);
+      delete readStream;
     }
 
-    void writeFieldWithAppearanceForText(handles_t handles, DictionaryContext* targetFieldDict, PDFObjectCastPtr<PDFDictionary> sourceFieldDictionary, bool appearanceInField, pdf_value_t textToWrite, std::map<std::string, pdf_value_t> inheritedProperties) {
+    void writeFieldWithAppearanceForText(handles_t& handles, DictionaryContext* targetFieldDict, const field_node_t& field, const pdf_value_t& textToWrite) {
       // determine how to write appearance
-      ObjectIDType newAppearanceFormId = handles.objectsContext.GetInDirectObjectsRegistry().AllocateNewObjectID();
-      if(appearanceInField) {
+      if(field.appearanceInField) {
         // Appearance in field - so write appearance dict in field
+        text_appearance_t appearance = planTextAppearance(handles, field, textToWrite);
+        bool fresh;
+        ObjectIDType appearanceFormId = getTextAppearanceId(handles, appearance, fresh);
         targetFieldDict->WriteKey("AP");
 
         DictionaryContext* apDict = handles.objectsContext.StartDictionary();
         apDict->WriteKey("N");
-        apDict->WriteObjectReferenceValue(newAppearanceFormId);
+        apDict->WriteObjectReferenceValue(appearanceFormId);
         handles.objectsContext.EndDictionary(apDict);
         handles.objectsContext.EndDictionary(targetFieldDict);
         handles.objectsContext.EndIndirectObject();
-      } else {
-        // finish the field object
+
+        // write the new stream xobject, unless an identical one is there already
+        if(fresh) {
+          writeAppearanceXObjectForText(handles, appearanceFormId, appearance);
+        }
+      } else if(!field.hasKids) {
+        // no widget to show the value in, just finish the field object
         handles.objectsContext.EndDictionary(targetFieldDict);
         handles.objectsContext.EndIndirectObject();
+      } else {
+        // write the kids, which will also finish the field object
+        targetFieldDict->WriteKey("Kids");
+        std::vector<ObjectIDType> kidIds = writeKidsAndEndObject(handles, targetFieldDict, field.kids);
+
+        // recreate widget kids, with new stream references. normally there's just one
+        std::vector<text_appearance_t> appearances(field.kids.size());
+        std::vector<ObjectIDType> appearanceFormIds(field.kids.size(), 0);
+        std::vector<bool> fresh(field.kids.size(), false);
+        for(size_t i = 0; i < field.kids.size(); i++) {
+          const field_node_t& kid = field.kids[i];
+          if(!kid.parsed) {
+            continue;
+          }
 
-        // write in kid (there should be just one)
-        PDFObjectCastPtr<PDFArray> kidsArray = handles.reader.QueryDictionaryObject(sourceFieldDictionary.GetPtr(), "Kids");
-        std::vector<field_ref_t> fieldsReferences = writeKidsAndEndObject(handles, targetFieldDict, kidsArray);
+          bool freshAppearance;
+          appearances[i] = planTextAppearance(handles, kid, textToWrite);
+          appearanceFormIds[i] = getTextAppearanceId(handles, appearances[i], freshAppearance);
+          fresh[i] = freshAppearance;
+          startFieldObject(handles, kid, kidIds[i]);
 
-        // recreate widget kid, with new stream reference
-        field_ref_t fieldReference = fieldsReferences[0];
+          DictionaryContext* modifiedDict = startModifiedDictionary(handles, kid.entries, KEY_AP);
+          modifiedDict->WriteKey("AP");
 
-        PDFObjectCastPtr<PDFDictionary> sourceField;
-        if(fieldReference.existing) {
-          handles.objectsContext.StartModifiedIndirectObject(fieldReference.id);
-          sourceField = handles.reader.ParseNewObject(fieldReference.id);
-        } else {
-          handles.objectsContext.StartNewIndirectObject(fieldReference.id);
-          sourceField = fieldReference.field;
+          DictionaryContext* apDict = handles.objectsContext.StartDictionary();
+          apDict->WriteKey("N");
+          apDict->WriteObjectReferenceValue(appearanceFormIds[i]);
+          handles.objectsContext.EndDictionary(apDict);
+          handles.objectsContext.EndDictionary(modifiedDict);
+          handles.objectsContext.EndIndirectObject();
         }
 
-        DictionaryContext* modifiedDict = startModifiedDictionary(handles, sourceField, {"AP"});
-        modifiedDict->WriteKey("AP");
-
-        DictionaryContext* apDict = handles.objectsContext.StartDictionary();
-        apDict->WriteKey("N");
-        apDict->WriteObjectReferenceValue(newAppearanceFormId);
-        handles.objectsContext.EndDictionary(apDict);
-        handles.objectsContext.EndDictionary(modifiedDict);
-        handles.objectsContext.EndIndirectObject();
+        // write the new stream xobjects
+        for(size_t i = 0; i < field.kids.size(); i++) {
+          if(fresh[i]) {
+            writeAppearanceXObjectForText(handles, appearanceFormIds[i], appearances[i]);
+          }
+        }
       }
-
-      // write the new stream xobject
-      writeAppearanceXObjectForText(handles, newAppearanceFormId, sourceFieldDictionary, textToWrite, inheritedProperties);
     }
 
-    void updateTextValue(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary, pdf_value_t value, bool isRich, std::map<std::string, pdf_value_t> inheritedProperties) {
-      std::vector<std::string> fieldsToRemove;
-      bool appearanceInField = fieldDictionary->Exists("Subtype");
-      if(appearanceInField) {
-        PDFObjectCastPtr<PDFName> subtype = fieldDictionary->QueryDirectObject("Subtype");
-        appearanceInField = (subtype->GetValue() == "Widget" || !fieldDictionary->Exists("Kids"));
-      }
-      fieldsToRemove.push_back("V");
-
-      if(appearanceInField) {
+    /**
+     * keys to drop from a text or choice field that's being rewritten. the appearance goes either in the field itself,
+     * or in its widget kids which get rewritten as well
+     */
+    key_set_t textFieldKeysToRemove(const field_node_t& field) {
+      key_set_t fieldsToRemove = KEY_V;
+      if(field.appearanceInField) {
         // add skipping AP if in field (and not in a child widget)
-        fieldsToRemove.push_back("AP");
+        fieldsToRemove |= KEY_AP;
+      } else if(field.hasKids) {
+        fieldsToRemove |= KEY_KIDS;
       }
+      return fieldsToRemove;
+    }
+
+    void updateTextValue(handles_t& handles, const field_node_t& field, const pdf_value_t& value, bool isRich) {
+      key_set_t fieldsToRemove = textFieldKeysToRemove(field);
       if(isRich) {
         // skip RV if rich
-        fieldsToRemove.push_back("RV");
+        fieldsToRemove |= KEY_RV;
       }
 
-      DictionaryContext* modifiedDict = startModifiedDictionary(handles, fieldDictionary, fieldsToRemove);
+      DictionaryContext* modifiedDict = startModifiedDictionary(handles, field.entries, fieldsToRemove);
 
       // start with value, setting both plain value and rich value
       modifiedDict->WriteKey("V");
@@ -864,131 +1319,110 @@ class pdf_form_fill {
         modifiedDict->WriteLiteralStringValue(PDFHexString(value.ToString()));
       }
 
-      writeFieldWithAppearanceForText(handles, modifiedDict, fieldDictionary, appearanceInField, value, inheritedProperties);
+      writeFieldWithAppearanceForText(handles, modifiedDict, field, value);
     }
 
-    void updateChoiceValue(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary, pdf_value_t value, std::map<std::string, pdf_value_t> inheritedProperties) {
-      bool appearanceInField = fieldDictionary->Exists("Subtype");
-      if(appearanceInField) {
-        PDFObjectCastPtr<PDFName> subtype = fieldDictionary->QueryDirectObject("Subtype");
-        appearanceInField = (subtype->GetValue() == "Widget" || !fieldDictionary->Exists("Kids"));
+    /**
+     * the text a choice value shows in its appearance. the first selected option when there are several
+     */
+    std::string getChoiceText(const pdf_value_t& value) {
+      if(!isMultipleChoice(value)) {
+        return value.ToString();
       }
 
-      std::vector<std::string> fieldsToRemove = { "V" };
+      std::vector<std::string> options = value.ToStrings();
+      return options.empty() ? "" : options[0];
+    }
 
-      if (appearanceInField) {
-        // add skipping AP if in field (and not in a child widget)
-        fieldsToRemove.push_back("AP");
-      }
+    static bool isMultipleChoice(const pdf_value_t& value) {
+      return value.type() == pdf_value_t::STRINGS || value.type() == pdf_value_t::PDFARRAY;
+    }
 
-      DictionaryContext* modifiedDict = startModifiedDictionary(handles, fieldDictionary, fieldsToRemove);
+    void updateChoiceValue(handles_t& handles, const field_node_t& field, const pdf_value_t& value) {
+      DictionaryContext* modifiedDict = startModifiedDictionary(handles, field.entries, textFieldKeysToRemove(field));
 
-      // start with value, setting per one or multiple selection. also choose the text to write in appearance
-      std::string textToWrite;
-      if(value.type() == "string") {
+      // start with value, setting per one or multiple selection
+      if(!isMultipleChoice(value)) {
         // one option
         modifiedDict->WriteKey("V");
         modifiedDict->WriteLiteralStringValue(PDFTextString(value.ToString()).ToString());
-        textToWrite = value.ToString();
       } else {
         // multiple options
         modifiedDict->WriteKey("V");
         handles.objectsContext.StartArray();
-        PDFObjectCastPtr<PDFArray> array = value.ToPDFArray();
-        SingleValueContainerIterator<PDFObjectVector> it = array->GetIterator();
-        bool first = true;
-        textToWrite = "";
-        while(it.MoveNext()) {
-          PDFObjectCastPtr<PDFLiteralString> field = it.GetItem();
-          if(first) {
-            first = false;
-            textToWrite = field->GetValue();
-          }
-          handles.objectsContext.WriteLiteralString(field->GetValue());
+        for(const std::string& option : value.ToStrings()) {
+          handles.objectsContext.WriteLiteralString(option);
         }
         handles.objectsContext.EndArray();
       }
 
-      writeFieldWithAppearanceForText(handles, modifiedDict, fieldDictionary, appearanceInField, textToWrite, inheritedProperties);
+      writeFieldWithAppearanceForText(handles, modifiedDict, field, getChoiceText(value));
+    }
+
+    /**
+     * the value a checkbox or radio button gets set with. radio buttons take the index of the kid to turn on, or its
+     * export value, checkboxes a bool, which ends up as no value for off
+     */
+    pdf_value_t getButtonValue(const field_node_t& field, const pdf_value_t& value) {
+      if(((field.flags >> 15) & 1) != 0) {
+        if(value.type() == pdf_value_t::BOOL) {
+          // never a kid index. true only turns on a radio that is a single option
+          return value.ToBool() && (field.isWidget || !field.hasKids) ? value : pdf_value_t();
+        }
+        if(value.type() != pdf_value_t::STRING || field.isWidget || !field.hasKids) {
+          return value;
+        }
+
+        long kid = findExportValue(field, value.ToString());
+        return kid >= 0 ? pdf_value_t((long long)kid) : pdf_value_t();
+      }
+      return value.ToBool() ? pdf_value_t(false) : pdf_value_t();
     }
 
     /**
      * Update a field. splits to per type functions
      */
-    void updateFieldWithValue(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary, pdf_value_t value, std::map<std::string, pdf_value_t> inheritedProperties) {
+    void updateFieldWithValue(handles_t& handles, const field_node_t& field, const pdf_value_t& value) {
       // Update a field with value. There is a logical assumption made here:
       // This must be a terminal field. meaning it is a field, and it either has no kids, it also holding
       // Widget data or that it has one or more kids defining its widget annotation(s). Normally it would be
       // One but in the case of a radio button, where there's one per option.
-      std::string localFieldType = "";
-      std::string fieldType = "";
-      long long   localFlags = 0;
-      long long   flags = 0;
-
-      PDFObjectCastPtr<PDFName> ft = fieldDictionary->QueryDirectObject("FT");
-      if(ft != NULL) {
-        fieldType = ft->GetValue();
-      } else {
-        fieldType = inheritedProperties["FT"].ToString();
-      }
-
-      PDFObjectCastPtr<PDFInteger> ff = fieldDictionary->QueryDirectObject("Ff");
-      if(ff != NULL) {
-        flags = ff->GetValue();
-      } else {
-        flags = inheritedProperties["Ff"].ToInteger();
-      }
+      const std::string& fieldType = field.fieldType;
+      long long flags = field.flags;
 
       // the rest is fairly type dependent, so let's check the type
       if(fieldType == "Btn") {
         if((flags >> 16) & 1) {
           // push button. can't write a value. forget it.
-          defaultTerminalFieldWrite(handles, fieldDictionary);
+          defaultTerminalFieldWrite(handles, field);
         } else {
           // checkbox or radio button
-          updateOptionButtonValue(handles,fieldDictionary,(((flags >> 15) & 1) != 0) ? value : (value.ToBool() ? pdf_value_t(false): pdf_value_t()));
+          updateOptionButtonValue(handles, field, getButtonValue(field, value));
         }
       } else if(fieldType == "Tx") {
         // rich or plain text
-        updateTextValue(handles, fieldDictionary, value, (flags >> 25) & 1, inheritedProperties);
+        updateTextValue(handles, field, value, (flags >> 25) & 1);
       } else if(fieldType == "Ch") {
-        updateChoiceValue(handles, fieldDictionary, value, inheritedProperties);
+        updateChoiceValue(handles, field, value);
       } else if(fieldType == "Sig") {
         // signature, ain't handling that. should return or throw an error sometimes
-        defaultTerminalFieldWrite(handles, fieldDictionary);
+        defaultTerminalFieldWrite(handles, field);
       } else {
         // in case there's a fault and there's no type, or it's irrelevant
-        defaultTerminalFieldWrite(handles, fieldDictionary);
+        defaultTerminalFieldWrite(handles, field);
       }
     }
 
-    void writeFieldAndKids(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary, std::map<std::string, pdf_value_t> inheritedProperties, std::string baseFieldName) {
+    void writeFieldAndKids(handles_t& handles, const field_node_t& field) {
       // this field or widget doesn't need value rewrite. but its kids might. so write the dictionary as is, dropping kids.
       // write them later and recurse.
+      DictionaryContext* modifiedFieldDict = startModifiedDictionary(handles, field.entries, KEY_KIDS);
 
-      DictionaryContext* modifiedFieldDict = startModifiedDictionary(handles, fieldDictionary, { "Kids" });
-      // if kids exist, continue to them for extra filling!
-      PDFObjectCastPtr<PDFArray> kids = handles.reader.QueryDictionaryObject(fieldDictionary.GetPtr(), "Kids");
-
-      if(kids != NULL) {
-        std::map<std::string, pdf_value_t> localEnv;
-
-        // prep some inherited values and push env
-        if (fieldDictionary->Exists("FT"))
-          localEnv["FT"] = ((PDFObjectCastPtr<PDFName>) fieldDictionary->QueryDirectObject("FT"))->GetValue();
-        if (fieldDictionary->Exists("Ff"))
-          localEnv["Ff"] = ((PDFObjectCastPtr<PDFInteger>) fieldDictionary->QueryDirectObject("Ff"))->GetValue();
-        if (fieldDictionary->Exists("DA"))
-          localEnv["DA"] = ((PDFObjectCastPtr<PDFName>) fieldDictionary->QueryDirectObject("DA"))->GetValue();
-        if (fieldDictionary->Exists("Q"))
-          localEnv["Q"] = ((PDFObjectCastPtr<PDFInteger>) fieldDictionary->QueryDirectObject("Q"))->GetValue();
-        if (fieldDictionary->Exists("Opt"))
-          localEnv["Opt"] = (PDFObjectCastPtr<PDFArray>) fieldDictionary->QueryDirectObject("Opt");
-
+      if(field.hasKids) {
+        // if kids exist, continue to them for extra filling!
         modifiedFieldDict->WriteKey("Kids");
         // recurse to kids. note that this will take care of ending this object
-        localEnv.insert(inheritedProperties.begin(), inheritedProperties.end());
-        writeFilledFields(handles, modifiedFieldDict, kids, localEnv, baseFieldName + ".");
+        writeFilledFields(handles, modifiedFieldDict, field.kids);
       } else {
         // no kids, can finish object now
         handles.objectsContext.EndDictionary(modifiedFieldDict);
@@ -1000,89 +1434,157 @@ class pdf_form_fill {
      * writes a single field. will fill with value if found in data.
      * assuming that's in indirect object and having to write the dict,finish the dict, indirect object and write the kids
      */
-    void writeFilledField(handles_t handles, PDFObjectCastPtr<PDFDictionary> fieldDictionary, std::map<std::string, pdf_value_t> inheritedProperties, std::string baseFieldName) {
-      std::string fullName = "";
-      PDFObject* value;
-      if((value = fieldDictionary->QueryDirectObject("T")) != NULL) {
-        ParsedPrimitiveHelper helper(value);
-        fullName = baseFieldName + helper.ToString();
-      } else {
-        fullName = baseFieldName;
-      }
-
-      // Based on the fullName we can now determine whether the field has a value that needs setting
-      auto found = handles.data.find(fullName);
-      if(found != handles.data.end()) {
+    void writeFilledField(handles_t& handles, const field_node_t& field) {
+      handles.stats.fieldsVisited++;
+      // the index already told which fields have a value that needs setting
+      auto found = handles.values.find(&field);
+      if(found != handles.values.end()) {
         // We got a winner! write with updated value
-        updateFieldWithValue(handles, fieldDictionary, handles.data[fullName], inheritedProperties);
-      } else {
-        // Not yet. write and recurse to kids
-        writeFieldAndKids(handles, fieldDictionary, inheritedProperties, fullName);
+        updateFieldWithValue(handles, field, *found->second);
+        return;
       }
+
+      // Not yet. write and recurse to kids
+      writeFieldAndKids(handles, field);
     }
 
     /**
-     * Write kids array converting each direct kids to an indirect one
+     * Write kids array converting each direct kids to an indirect one. returns the object id of each kid
      */
-    std::vector<field_ref_t> writeKidsAndEndObject(handles_t handles, DictionaryContext* parentDict, PDFObjectCastPtr<PDFArray> kidsArray) {
-      std::vector<field_ref_t> fieldsReferences;
+    std::vector<ObjectIDType> writeKidsAndEndObject(handles_t& handles, DictionaryContext* parentDict, const std::vector<field_node_t>& kids) {
+      std::vector<ObjectIDType> kidIds;
 
       handles.objectsContext.StartArray();
-      SingleValueContainerIterator<PDFObjectVector> it = kidsArray->GetIterator();
-      while(it.MoveNext()) {
-        PDFObject* field = it.GetItem();
-        if(field->GetType() == PDFDictionary::ePDFObjectIndirectObjectReference) {
+      for(const field_node_t& kid : kids) {
+        if(kid.existing) {
           // existing reference, keep as is
-          handles.copyingContext->CopyDirectObjectAsIs(field);
-          fieldsReferences.push_back({true, ((PDFObjectCastPtr<PDFIndirectObjectReference>)field)->mObjectID, NULL});
-        } else {
-          ObjectIDType newFieldObjectId = handles.objectsContext.GetInDirectObjectsRegistry().AllocateNewObjectID();
+          handles.objectsContext.WriteIndirectObjectReference(kid.id);
+          kidIds.push_back(kid.id);
+        } else if(kid.parsed) {
           // direct object, recreate as reference
-          fieldsReferences.push_back({false, newFieldObjectId, field});
+          ObjectIDType newFieldObjectId = handles.objectsContext.GetInDirectObjectsRegistry().AllocateNewObjectID();
           handles.objectsContext.WriteIndirectObjectReference(newFieldObjectId);
+          kidIds.push_back(newFieldObjectId);
+        } else {
+          // not a dictionary, nothing we can point at
+          kidIds.push_back(0);
         }
       }
       handles.objectsContext.EndArray(eTokenSeparatorEndLine);
       handles.objectsContext.EndDictionary(parentDict);
       handles.objectsContext.EndIndirectObject();
-      return fieldsReferences;
+      return kidIds;
     }
 
     /**
      * write fields/kids array of dictionary. make sure all become indirect, for the sake of simplicity,
      * which is why it gets to take care of finishing the writing of the said dict
      */
-    void writeFilledFields(handles_t handles, DictionaryContext* parentDict, PDFObjectCastPtr<PDFArray> fields, std::map<std::string, pdf_value_t> inheritedProperties, std::string baseFieldName) {
-      std::vector<field_ref_t> fieldsReferences = writeKidsAndEndObject(handles, parentDict, fields);
+    void writeFilledFields(handles_t& handles, DictionaryContext* parentDict, const std::vector<field_node_t>& fields) {
+      std::vector<ObjectIDType> fieldIds = writeKidsAndEndObject(handles, parentDict, fields);
       // now recreate the fields, filled this time (and down the recursion hole...)
-      for(size_t i = 0; i < fieldsReferences.size(); i++) {
-        if(fieldsReferences[i].existing) {
-          handles.objectsContext.StartModifiedIndirectObject(fieldsReferences[i].id);
-          PDFObjectCastPtr<PDFDictionary> refdict = handles.reader.ParseNewObject(fieldsReferences[i].id);
-          writeFilledField(handles, refdict, inheritedProperties, baseFieldName);
+      for(size_t i = 0; i < fields.size(); i++) {
+        if(!fields[i].parsed) {
+          continue;
+        }
+        if(handles.options.minimalUpdate && fields[i].existing) {
+          // keeps its object id, so the array still points at it. only rewrite it if it changes
+          writeTouchedField(handles, fields[i]);
+          continue;
+        }
+        startFieldObject(handles, fields[i], fieldIds[i]);
+        writeFilledField(handles, fields[i]);
+      }
+    }
+
+    bool isFilled(handles_t& handles, const field_node_t& field) {
+      return handles.values.count(&field) != 0;
+    }
+
+    /**
+     * whether updateFieldWithValue can set a value on the field. push buttons, signatures and fields without a type
+     * keep theirs
+     */
+    bool isWritableField(const field_node_t& field) {
+      if(field.fieldType == "Btn") {
+        return ((field.flags >> 16) & 1) == 0;
+      }
+      return field.fieldType == "Tx" || field.fieldType == "Ch";
+    }
+
+    /**
+     * look the data up in the field index. names the form doesn't have are skipped.
+     * for minimal updates also mark the filled fields and their ancestors, a filled field takes care of its own widgets
+     */
+    void resolveValues(handles_t& handles) {
+      for(const auto& item : handles.data) {
+        const field_index_entry_t* entry = handles.form.findField(item.first);
+        if(entry == NULL) {
+          if(handles.options.debug) {
+            printf("no field named %s\n", item.first.c_str());
+          }
+          handles.stats.unknownFields++;
+          continue;
+        }
+
+        if(isWritableField(*entry->field)) {
+          handles.stats.fieldsFilled++;
         } else {
-          handles.objectsContext.StartNewIndirectObject(fieldsReferences[i].id);
-          PDFObjectCastPtr<PDFDictionary> refdict = fieldsReferences[i].field;
-          writeFilledField(handles, refdict, inheritedProperties, baseFieldName);
+          handles.stats.fieldsSkipped++;
+        }
+        handles.values[entry->field] = &item.second;
+        if(handles.options.minimalUpdate) {
+          handles.dirty.insert(entry->field);
+          handles.dirty.insert(entry->ancestors.begin(), entry->ancestors.end());
         }
       }
     }
 
     /**
-     * Write a filled form dictionary, and its subordinate fields.
-     * assumes in an indirect object, so will finish it
+     * a direct kid that changes has to become indirect, and the only way there is rewriting the parent Kids array
+     */
+    bool hasDirtyDirectKid(handles_t& handles, const std::vector<field_node_t>& kids) {
+      for(const field_node_t& kid : kids) {
+        if(!kid.existing && handles.dirty.count(&kid) != 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * minimal update of an indirect field. the field object itself is only rewritten when it gets a value, or when one of
+     * its direct kids does. otherwise it stays as is, and only the kids that change are looked into
      */
-    void writeFilledForm(handles_t handles, PDFObjectCastPtr<PDFDictionary> acroformDict) {
-      DictionaryContext* modifiedAcroFormDict = startModifiedDictionary(handles, acroformDict, { "Fields" });
+    void writeTouchedField(handles_t& handles, const field_node_t& field) {
+      if(handles.dirty.count(&field) == 0) {
+        return;
+      }
+      handles.stats.fieldsVisited++;
 
-      PDFObjectCastPtr<PDFArray> fields = NULL;
-      if(acroformDict->Exists("Fields")) {
-        fields = handles.reader.QueryDictionaryObject(acroformDict.GetPtr(), "Fields");
+      if(isFilled(handles, field) || hasDirtyDirectKid(handles, field.kids)) {
+        handles.objectsContext.StartModifiedIndirectObject(field.id);
+        writeFilledField(handles, field);
+        return;
       }
 
-      if(fields != NULL) {
+      for(const field_node_t& kid : field.kids) {
+        if(kid.existing) {
+          writeTouchedField(handles, kid);
+        }
+      }
+    }
+
+    /**
+     * Write a filled form dictionary, and its subordinate fields.
+     * assumes in an indirect object, so will finish it
+     */
+    void writeFilledForm(handles_t& handles, const form_template_t& form) {
+      DictionaryContext* modifiedAcroFormDict = startModifiedDictionary(handles, form.acroformEntries, KEY_FIELDS);
+
+      if(form.hasFields) {
         modifiedAcroFormDict->WriteKey("Fields");
-        writeFilledFields(handles, modifiedAcroFormDict, fields, { }, ""); // will also take care of finishing the dictionary and indirect object, so no need to finish after
+        writeFilledFields(handles, modifiedAcroFormDict, form.fields); // will also take care of finishing the dictionary and indirect object, so no need to finish after
       } else {
         handles.objectsContext.EndDictionary(modifiedAcroFormDict);
         handles.objectsContext.EndIndirectObject();
@@ -1090,66 +1592,1655 @@ class pdf_form_fill {
       fflush(stdout);
     }
 
-  public:
-    void fillForm(PDFWriter& writer, std::map<std::string, pdf_value_t> data, options_t options = { false, NULL }) {
-      PDFParser& reader = writer.GetModifiedFileParser();
-
-      PDFObjectCastPtr<PDFDictionary> catalogDict = reader.QueryDictionaryObject(reader.GetTrailer(), "Root");
+    /**
+     * the button state a value turns a widget to, the same updateOptionButtonValue sets its AS to
+     */
+    std::string getButtonState(const page_widget_t& item, const pdf_value_t& value) {
+      const field_node_t& field = *item.field;
+      if(field.isWidget || !field.hasKids) {
+        return value.type() == pdf_value_t::NONE ? "Off" : item.widget->onState;
+      }
 
-      if(catalogDict == NULL) {
-        throw "Root not found";
+      if(value.type() == pdf_value_t::NONE || value.ToInteger() != item.kid) {
+        return "Off";
       }
+      return item.widget->onState;
+    }
+
+    /**
+     * the appearance a widget is flattened with: a new one for filled text and choice fields, the state its value turns
+     * it to for buttons, and the one it has for everything else. box is the appearance BBox as placed by its Matrix.
+     * false if there's nothing to paint
+     */
+    bool getFlattenedAppearance(handles_t& handles, const page_widget_t& item, ObjectIDType& id, PDFRectangle& box) {
+      const field_node_t& widget = *item.widget;
+      std::string state = widget.appearanceState;
+
+      auto found = handles.values.find(item.field);
+      if(found != handles.values.end()) {
+        const pdf_value_t& value = *found->second;
+        if(widget.fieldType == "Tx" || widget.fieldType == "Ch") {
+          text_appearance_t appearance = planTextAppearance(handles, widget, widget.fieldType == "Tx" ? value : pdf_value_t(getChoiceText(value)));
+          bool fresh;
+          id = getTextAppearanceId(handles, appearance, fresh);
+          if(fresh) {
+            writeAppearanceXObjectForText(handles, id, appearance);
+          }
+          box = PDFRectangle(0, 0, appearance.boxWidth, appearance.boxHeight);
+          return true;
+        }
 
-      PDFObject* acroformInCatalog = catalogDict->QueryDirectObject("AcroForm");
+        if(widget.fieldType == "Btn" && ((widget.flags >> 16) & 1) == 0) {
+          state = getButtonState(item, getButtonValue(*item.field, value));
+        }
+      }
 
-      if(catalogDict == NULL) {
-        throw "AcroForm not found 1";
+      for(const normal_appearance_t& appearance : widget.normalAppearances) {
+        if(appearance.state.empty() || appearance.state == state) {
+          id = appearance.id;
+          box = appearance.box;
+          return true;
+        }
       }
+      return false;
+    }
 
-      PDFDocumentCopyingContext* copyingContext = writer.CreatePDFCopyingContextForModifiedFile();
-      ObjectsContext& objectsContext = writer.GetObjectsContext();
+    ObjectIDType writeContentStream(handles_t& handles, const std::string& content) {
+      ObjectIDType id = handles.objectsContext.StartNewIndirectObject();
+      PDFStream* stream = handles.objectsContext.StartPDFStream();
+      stream->GetWriteStream()->Write((const IOBasicTypes::Byte*)content.data(), content.size());
+      handles.objectsContext.EndPDFStream(stream);
+      delete stream;
+      return id;
+    }
 
-      PDFObject* acroformDict = reader.QueryDictionaryObject(catalogDict.GetPtr(), "AcroForm");
-      if(acroformDict == NULL) {
-        throw "AcroForm not found 2";
+    // write already serialized array items, into the array being written
+    void writeArrayItems(handles_t& handles, const std::vector<const std::string*>& items) {
+      IByteWriterWithPosition* stream = handles.objectsContext.StartFreeContext();
+      for(const std::string* item : items) {
+        stream->Write((const IOBasicTypes::Byte*)item->data(), item->size());
+        stream->Write((const IOBasicTypes::Byte*)" ", 1);
       }
+      handles.objectsContext.EndFreeContext();
+    }
 
-      handles_t handles = {
-        .writer = writer,
-        .reader = reader,
-        .copyingContext = copyingContext,
-        .objectsContext = objectsContext,
-        .data = data,
-        .acroformDict = acroformDict,
-        .options = options,
-      };
+    /**
+     * flatten the filled form, one rewrite per page with widgets on it. the page content gets wrapped in q/Q, and
+     * followed by a stream painting every widget appearance into its Rect, in Annots order. the widgets leave Annots,
+     * and the AcroForm leaves the catalog. field objects aren't written, nothing points at them anymore.
+     * hidden and NoView widgets are dropped without being painted
+     */
+    void flattenForm(handles_t& handles) {
+      ObjectsContext& objectsContext = handles.objectsContext;
+      ObjectIDType saveStateId = 0;
+      std::string content;
 
-      // recreate a copy of the existing form, which we will fill with data.
-      if(acroformInCatalog->GetType() == PDFDictionary::ePDFObjectIndirectObjectReference) {
-        // if the form is a referenced object, modify it
-        ObjectIDType acroformObjectId = (PDFObjectCastPtr<PDFIndirectObjectReference>(acroformInCatalog))->mObjectID;
-        objectsContext.StartModifiedIndirectObject(acroformObjectId);
+      for(const page_t& page : handles.form.pages) {
+        if(page.widgets.empty()) {
+          continue;
+        }
 
-        writeFilledForm(handles, acroformDict);
-      } else {
-        // otherwise, recreate the form as an indirect child (this is going to be a general policy, we're making things indirect. it's simpler), and recreate the catalog
-        ObjectIDType catalogObjectId = (PDFObjectCastPtr<PDFIndirectObjectReference>(reader.GetTrailer()->QueryDirectObject("Root")))->mObjectID;
-        ObjectIDType newAcroformObjectId = objectsContext.GetInDirectObjectsRegistry().AllocateNewObjectID();
+        std::unordered_set<std::string> usedNames;
+        for(const dictionary_entry_t& entry : page.xobjectEntries.entries) {
+          usedNames.insert(entry.key);
+        }
 
-        // recreate the catalog with form pointing to new reference
-        objectsContext.StartModifiedIndirectObject(catalogObjectId);
-        DictionaryContext* modifiedCatalogDictionary = startModifiedDictionary(handles, catalogDict, {"AcroForm"});
+        std::unordered_set<ObjectIDType> flattened;
+        std::unordered_map<ObjectIDType, std::string> names;
+        std::vector<std::pair<std::string, ObjectIDType>> xobjects;
+        content = "Q\n";
+
+        for(const page_widget_t& item : page.widgets) {
+          const field_node_t& widget = *item.widget;
+          flattened.insert(widget.id);
+          handles.stats.fieldsVisited++;
+          if((widget.annotationFlags & (2 | 32)) != 0 || !widget.hasRect) {
+            continue;
+          }
 
-        modifiedCatalogDictionary->WriteKey("AcroForm");
-        modifiedCatalogDictionary->WriteObjectReferenceValue(newAcroformObjectId);
-        objectsContext.EndDictionary(modifiedCatalogDictionary);
-        objectsContext.EndIndirectObject();
+          ObjectIDType appearanceId;
+          PDFRectangle box;
+          if(!getFlattenedAppearance(handles, item, appearanceId, box)) {
+            continue;
+          }
 
-        // now create the new form object
-        objectsContext.StartNewIndirectObject(newAcroformObjectId);
+          double boxWidth = box.UpperRightX - box.LowerLeftX;
+          double boxHeight = box.UpperRightY - box.LowerLeftY;
+          if(boxWidth == 0 || boxHeight == 0) {
+            continue;
+          }
+
+          std::string& name = names[appearanceId];
+          if(name.empty()) {
+            for(size_t i = xobjects.size(); name.empty() || usedNames.count(name) != 0; i++) {
+              name = "FlatField" + std::to_string(i);
+            }
+            usedNames.insert(name);
+            xobjects.push_back(std::make_pair(name, appearanceId));
+          }
+
+          // fit the appearance box into the widget Rect
+          double left = std::min(widget.rect.LowerLeftX, widget.rect.UpperRightX);
+          double bottom = std::min(widget.rect.LowerLeftY, widget.rect.UpperRightY);
+          double scaleX = std::abs(widget.rect.UpperRightX - widget.rect.LowerLeftX) / boxWidth;
+          double scaleY = std::abs(widget.rect.UpperRightY - widget.rect.LowerLeftY) / boxHeight;
+          content += "q " + pdf_form_serialize::formatNumber(scaleX) + " 0 0 " + pdf_form_serialize::formatNumber(scaleY) + " " +
+            pdf_form_serialize::formatNumber(left - box.LowerLeftX * scaleX) + " " + pdf_form_serialize::formatNumber(bottom - box.LowerLeftY * scaleY) + " cm /" + name + " Do Q\n";
+        }
+
+        // nothing painted, the content stays as it is
+        bool painted = !xobjects.empty();
+        ObjectIDType contentId = 0;
+        if(painted) {
+          if(saveStateId == 0) {
+            saveStateId = writeContentStream(handles, "q\n");
+          }
+          contentId = writeContentStream(handles, content);
+        }
 
-        writeFilledForm(handles, acroformDict);
+        objectsContext.StartModifiedIndirectObject(page.id);
+        DictionaryContext* pageDict = painted ?
+          startModifiedDictionary(handles, page.entries, KEY_CONTENTS | KEY_RESOURCES | KEY_ANNOTS) :
+          startModifiedDictionary(handles, page.entries, KEY_ANNOTS);
+
+        if(painted) {
+          std::vector<const std::string*> contents;
+          for(const std::string& item : page.contents) {
+            contents.push_back(&item);
+          }
+
+          pageDict->WriteKey("Contents");
+          objectsContext.StartArray();
+          objectsContext.WriteIndirectObjectReference(saveStateId);
+          writeArrayItems(handles, contents);
+          objectsContext.WriteIndirectObjectReference(contentId);
+          objectsContext.EndArray(eTokenSeparatorEndLine);
+
+          pageDict->WriteKey("Resources");
+          DictionaryContext* resourcesDict = startModifiedDictionary(handles, page.resourceEntries, KEY_XOBJECT);
+          resourcesDict->WriteKey("XObject");
+          DictionaryContext* xobjectDict = startModifiedDictionary(handles, page.xobjectEntries, 0);
+          for(const auto& xobject : xobjects) {
+            xobjectDict->WriteKey(xobject.first);
+            xobjectDict->WriteObjectReferenceValue(xobject.second);
+          }
+          objectsContext.EndDictionary(xobjectDict);
+          objectsContext.EndDictionary(resourcesDict);
+        }
+
+        // the annotations that aren't widgets of the form stay
+        std::vector<const std::string*> annots;
+        for(const auto& annot : page.annots) {
+          if(annot.first == 0 || flattened.count(annot.first) == 0) {
+            annots.push_back(&annot.second);
+          }
+        }
+        if(!annots.empty()) {
+          pageDict->WriteKey("Annots");
+          objectsContext.StartArray();
+          writeArrayItems(handles, annots);
+          objectsContext.EndArray(eTokenSeparatorEndLine);
+        }
+
+        objectsContext.EndDictionary(pageDict);
+        objectsContext.EndIndirectObject();
+      }
+
+      objectsContext.StartModifiedIndirectObject(handles.form.catalogId);
+      DictionaryContext* catalogDict = startModifiedDictionary(handles, handles.form.catalogEntries, KEY_ACROFORM);
+      objectsContext.EndDictionary(catalogDict);
+      objectsContext.EndIndirectObject();
+    }
+
+    /**
+     * the bit of a key fills replace, 0 for the rest
+     */
+    static key_set_t keyBit(const std::string& key) {
+      static const std::unordered_map<std::string, key_set_t> bits = {
+        { "V", KEY_V }, { "AS", KEY_AS }, { "AP", KEY_AP }, { "RV", KEY_RV }, { "Kids", KEY_KIDS }, { "Fields", KEY_FIELDS },
+        { "AcroForm", KEY_ACROFORM }, { "Contents", KEY_CONTENTS }, { "Resources", KEY_RESOURCES }, { "Annots", KEY_ANNOTS },
+        { "XObject", KEY_XOBJECT },
+      };
+      auto found = bits.find(key);
+      return found != bits.end() ? found->second : 0;
+    }
+
+    void addDictionaryEntry(dictionary_entries_t& entries, const std::string& key, size_t offset, size_t size) {
+      key_set_t bit = keyBit(key);
+      entries.entries.push_back({ key, offset, size, bit });
+      entries.keys |= bit;
+    }
+
+    dictionary_entries_t readDictionaryEntries(PDFObjectCastPtr<PDFDictionary> dictionary) {
+      dictionary_entries_t entries;
+      MapIterator<PDFNameToPDFObjectMap> it = dictionary->GetIterator();
+      while(it.MoveNext()) {
+        size_t offset = entries.bytes.size();
+        std::string key = it.GetKey()->GetValue();
+        pdf_form_serialize::serializeName(key, entries.bytes);
+        entries.bytes += ' ';
+        pdf_form_serialize::serializeObject(it.GetValue(), entries.bytes);
+        entries.bytes += '\n';
+        addDictionaryEntry(entries, key, offset, entries.bytes.size() - offset);
+      }
+      return entries;
+    }
+
+    /**
+     * export values of a choice or radio field Opt array. an option is either a string or an [export, display] pair
+     */
+    std::vector<std::string> readOptions(PDFObjectCastPtr<PDFArray> opt) {
+      std::vector<std::string> options;
+      SingleValueContainerIterator<PDFObjectVector> it = opt->GetIterator();
+      while(it.MoveNext()) {
+        PDFObject* option = it.GetItem();
+        if(option->GetType() == PDFObject::ePDFObjectArray) {
+          RefCountPtr<PDFObject> exportValue(objectCache.query((PDFArray*)option, 0));
+          options.push_back(exportValue != NULL ? ParsedPrimitiveHelper(exportValue.GetPtr()).ToString() : "");
+        } else {
+          options.push_back(ParsedPrimitiveHelper(option).ToString());
+        }
+      }
+      return options;
+    }
+
+    double readRectCoordinate(PDFObjectCastPtr<PDFArray> rect, unsigned long index) {
+      RefCountPtr<PDFObject> coordinate(objectCache.query(rect.GetPtr(), index));
+      if(coordinate == NULL) {
+        return 0.0;
+      }
+      return ParsedPrimitiveHelper(coordinate.GetPtr()).GetAsDouble();
+    }
+
+    /**
+     * read the field out of its dictionary, resolving what it inherits, and go down to its kids
+     */
+    template <typename T>
+    const T* findInherited(const inherited_scope_t* scope, T inherited_scope_t::*property) {
+      for(; scope != NULL; scope = scope->parent) {
+        if((scope->*property) != NULL) {
+          return &(scope->*property);
+        }
+      }
+      return NULL;
+    }
+
+    void readField(PDFParser& reader, field_node_t& field, PDFObjectCastPtr<PDFDictionary> fieldDictionary, const inherited_scope_t* parentScope, const std::string& parentFieldName) {
+      field.parsed = true;
+      field.entries = readDictionaryEntries(fieldDictionary);
+
+      RefCountPtr<PDFObject> value(fieldDictionary->QueryDirectObject("T"));
+      if(value != NULL) {
+        ParsedPrimitiveHelper helper(value.GetPtr());
+        field.hasName = true;
+        field.fullName = parentFieldName.empty() ? helper.ToString() : parentFieldName + "." + helper.ToString();
+      } else {
+        // a widget, or some other nameless kid. it goes by its parent's name
+        field.fullName = parentFieldName;
+      }
+
+      // this field's own inheritable values, for itself and its kids
+      inherited_scope_t scope;
+      scope.parent = parentScope;
+      scope.ft = fieldDictionary->QueryDirectObject("FT");
+      scope.ff = fieldDictionary->QueryDirectObject("Ff");
+      scope.da = fieldDictionary->QueryDirectObject("DA");
+      scope.q = fieldDictionary->QueryDirectObject("Q");
+      scope.maxLen = fieldDictionary->QueryDirectObject("MaxLen");
+      if(fieldDictionary->Exists("Opt")) {
+        scope.opt = objectCache.query(fieldDictionary.GetPtr(), "Opt");
+      }
+
+      const PDFObjectCastPtr<PDFName>* ft = findInherited(&scope, &inherited_scope_t::ft);
+      if(ft != NULL) {
+        field.fieldType = ft->GetPtr()->GetValue();
+      }
+
+      const PDFObjectCastPtr<PDFInteger>* ff = findInherited(&scope, &inherited_scope_t::ff);
+      if(ff != NULL) {
+        field.flags = ff->GetPtr()->GetValue();
+      }
+
+      const RefCountPtr<PDFObject>* da = findInherited(&scope, &inherited_scope_t::da);
+      if(da != NULL) {
+        field.da = ParsedPrimitiveHelper(da->GetPtr()).ToString();
+      }
+
+      const PDFObjectCastPtr<PDFInteger>* q = findInherited(&scope, &inherited_scope_t::q);
+      if(q != NULL) {
+        field.q = q->GetPtr()->GetValue();
+      }
+
+      const PDFObjectCastPtr<PDFInteger>* maxLen = findInherited(&scope, &inherited_scope_t::maxLen);
+      if(maxLen != NULL) {
+        field.maxLen = maxLen->GetPtr()->GetValue();
+      }
+
+      const PDFObjectCastPtr<PDFArray>* opt = findInherited(&scope, &inherited_scope_t::opt);
+      if(opt != NULL) {
+        field.opt = readOptions(*opt);
+      }
+
+      PDFObjectCastPtr<PDFName> subtype = fieldDictionary->QueryDirectObject("Subtype");
+      field.isWidget = (subtype != NULL && subtype->GetValue() == "Widget");
+      field.appearanceInField = (subtype != NULL && (field.isWidget || !fieldDictionary->Exists("Kids")));
+
+      PDFObjectCastPtr<PDFArray> rect = objectCache.query(fieldDictionary.GetPtr(), "Rect");
+      if(rect != NULL && rect->GetLength() == 4) {
+        field.hasRect = true;
+        field.rect = PDFRectangle(
+          readRectCoordinate(rect, 0),
+          readRectCoordinate(rect, 1),
+          readRectCoordinate(rect, 2),
+          readRectCoordinate(rect, 3)
+        );
+      }
+
+      if(field.isWidget) {
+        field.page = findWidgetPage(reader, field, fieldDictionary);
+        readNormalAppearances(field, fieldDictionary);
+      }
+
+      if(!field.da.empty() && (field.fieldType == "Tx" || field.fieldType == "Ch")) {
+        field.style = getTextStyle(field.da);
+      }
+
+      // keep the original appearance of text and choice widgets, new appearances are built around it.
+      // buttons just need to know the name of their on state
+
+      if(fieldDictionary->Exists("AP")) {
+        if(field.fieldType == "Tx" || field.fieldType == "Ch") {
+          field.appearance = getOriginalTextFieldAppearance(reader, fieldDictionary);
+        } else if(field.fieldType == "Btn") {
+          field.onState = getOnAppearanceName(fieldDictionary);
+        }
+      }
+
+      PDFObjectCastPtr<PDFArray> kids = objectCache.query(fieldDictionary.GetPtr(), "Kids");
+      if(kids != NULL) {
+        field.hasKids = true;
+        readFields(reader, kids, field.kids, &scope, field.fullName);
+      }
+      indexExportValues(field);
+    }
+
+    /**
+     * read a fields/kids array into the model
+     */
+    void readFields(PDFParser& reader, PDFObjectCastPtr<PDFArray> fields, std::vector<field_node_t>& nodes, const inherited_scope_t* parentScope, const std::string& parentFieldName) {
+      nodes.reserve(fields->GetLength());
+      SingleValueContainerIterator<PDFObjectVector> it = fields->GetIterator();
+      while(it.MoveNext()) {
+        PDFObject* item = it.GetItem();
+        PDFObjectCastPtr<PDFDictionary> fieldDictionary;
+        nodes.push_back(field_node_t());
+        field_node_t& field = nodes.back();
+
+        if(item->GetType() == PDFObject::ePDFObjectIndirectObjectReference) {
+          field.existing = true;
+          field.id = ((PDFIndirectObjectReference*)item)->mObjectID;
+          fieldDictionary = objectCache.parse(field.id);
+        } else {
+          // the array keeps its own reference
+          item->AddRef();
+          fieldDictionary = item;
+        }
+
+        if(fieldDictionary != NULL) {
+          readField(reader, field, fieldDictionary, parentScope, parentFieldName);
+        }
+      }
+    }
+
+    /**
+     * a color component as the byte TextOptions wants it
+     */
+    unsigned long toColorByte(const std::string& component) {
+      double value = atof(component.c_str());
+      value = value < 0 ? 0 : (value > 1 ? 1 : value);
+      return (unsigned long)(value * 255 + 0.5);
+    }
+
+    /**
+     * take a DA string apart. it's a bit of content stream, setting the font (/Name size Tf) and the fill color (g, rg or k).
+     * anything else in it is ignored
+     */
+    text_style_t parseDA(const std::string& da) {
+      text_style_t style;
+      std::vector<std::string> operands;
+      size_t i = 0;
+
+      while(i < da.size()) {
+        if(isspace((unsigned char)da[i])) {
+          i++;
+          continue;
+        }
+
+        size_t start = i++;
+        while(i < da.size() && !isspace((unsigned char)da[i]) && da[i] != '/') {
+          i++;
+        }
+        std::string token = da.substr(start, i - start);
+
+        if(token[0] == '/' || isdigit((unsigned char)token[0]) || token[0] == '-' || token[0] == '+' || token[0] == '.') {
+          operands.push_back(token);
+          continue;
+        }
+
+        size_t count = operands.size();
+        if(token == "Tf" && count >= 2 && operands[count - 2][0] == '/') {
+          style.fontName = operands[count - 2].substr(1);
+          style.fontSize = atof(operands[count - 1].c_str());
+        } else if(token == "g" && count >= 1) {
+          style.colorSpace = AbstractContentContext::eGray;
+          style.colorValue = toColorByte(operands[count - 1]);
+          style.colorCode = operands[count - 1] + " g";
+        } else if(token == "rg" && count >= 3) {
+          style.colorSpace = AbstractContentContext::eRGB;
+          style.colorValue = 0;
+          style.colorCode = "";
+          for(size_t j = count - 3; j < count; j++) {
+            style.colorValue = (style.colorValue << 8) | toColorByte(operands[j]);
+            style.colorCode += operands[j] + " ";
+          }
+          style.colorCode += "rg";
+        } else if(token == "k" && count >= 4) {
+          style.colorSpace = AbstractContentContext::eCMYK;
+          style.colorValue = 0;
+          style.colorCode = "";
+          for(size_t j = count - 4; j < count; j++) {
+            style.colorValue = (style.colorValue << 8) | toColorByte(operands[j]);
+            style.colorCode += operands[j] + " ";
+          }
+          style.colorCode += "k";
+        }
+        operands.clear();
+      }
+      return style;
+    }
+
+    void readDRFonts(PDFObjectCastPtr<PDFDictionary> dr) {
+      PDFObjectCastPtr<PDFDictionary> fonts = objectCache.query(dr.GetPtr(), "Font");
+      if(fonts == NULL) {
+        return;
+      }
+
+      MapIterator<PDFNameToPDFObjectMap> it = fonts->GetIterator();
+      while(it.MoveNext()) {
+        if(it.GetValue()->GetType() != PDFObject::ePDFObjectIndirectObjectReference) {
+          // a direct font can't be pointed at from the appearances
+          continue;
+        }
+
+        std::string baseFont;
+        PDFObjectCastPtr<PDFDictionary> font = objectCache.query(fonts.GetPtr(), it.GetKey()->GetValue());
+        if(font != NULL) {
+          PDFObjectCastPtr<PDFName> baseFontName = font->QueryDirectObject("BaseFont");
+          if(baseFontName != NULL) {
+            baseFont = baseFontName->GetValue();
+          }
+        }
+        drFonts[it.GetKey()->GetValue()] = std::make_pair(((PDFIndirectObjectReference*)it.GetValue())->mObjectID, baseFont);
+      }
+    }
+
+    /**
+     * look for a local copy of a font in the font directory. by the /DR BaseFont (minus any subset prefix), by the
+     * DA name, and for the standard 14 fonts also by the names of their usual stand ins
+     */
+    void findLocalFont(text_style_t& style, const std::string& baseFont) {
+      if(fontDirectory.empty()) {
+        return;
+      }
+
+      static const std::map<std::string, std::vector<std::string>> standInFonts = {
+        { "Helvetica",             { "Arial", "ArialMT", "LiberationSans-Regular", "LiberationSans" } },
+        { "Helvetica-Bold",        { "Arial-Bold", "Arial-BoldMT", "LiberationSans-Bold" } },
+        { "Helvetica-Oblique",     { "Arial-Italic", "Arial-ItalicMT", "LiberationSans-Italic" } },
+        { "Times-Roman",           { "TimesNewRoman", "TimesNewRomanPSMT", "LiberationSerif-Regular", "LiberationSerif" } },
+        { "Times-Bold",            { "TimesNewRoman-Bold", "TimesNewRomanPS-BoldMT", "LiberationSerif-Bold" } },
+        { "Courier",               { "CourierNew", "CourierNewPSMT", "LiberationMono-Regular", "LiberationMono" } },
+        { "Courier-Bold",          { "CourierNew-Bold", "CourierNewPS-BoldMT", "LiberationMono-Bold" } },
+      };
+
+      std::vector<std::string> names;
+      if(!baseFont.empty()) {
+        size_t plus = baseFont.find('+');
+        names.push_back(plus == 6 ? baseFont.substr(plus + 1) : baseFont);
+      }
+      names.push_back(style.fontName);
+
+      size_t ownNames = names.size();
+      for(size_t i = 0; i < ownNames; i++) {
+        auto standIns = standInFonts.find(names[i]);
+        if(standIns != standInFonts.end()) {
+          names.insert(names.end(), standIns->second.begin(), standIns->second.end());
+        }
+      }
+
+      for(const std::string& name : names) {
+        for(const char* extension : { ".ttf", ".otf", ".ttc" }) {
+          std::string path = fontDirectory + "/" + name + extension;
+          FILE* file = fopen(path.c_str(), "rb");
+          if(file == NULL) {
+            continue;
+          }
+          fclose(file);
+
+          style.metrics = pdf_form_font::get(path);
+          if(style.metrics != NULL) {
+            style.fontPath = path;
+            return;
+          }
+        }
+      }
+    }
+
+    /**
+     * the text style of a DA string. forms use a handful of distinct ones for all their fields, so each is parsed and
+     * resolved once per template
+     */
+    std::shared_ptr<const text_style_t> getTextStyle(const std::string& da) {
+      auto cached = styleCache.find(da);
+      if(cached != styleCache.end()) {
+        return cached->second;
+      }
+
+      std::shared_ptr<text_style_t> style = std::make_shared<text_style_t>(parseDA(da));
+      std::string baseFont;
+      auto drFont = drFonts.find(style->fontName);
+      if(drFont != drFonts.end()) {
+        style->fontId = drFont->second.first;
+        baseFont = drFont->second.second;
+      }
+      findLocalFont(*style, baseFont);
+
+      styleCache[da] = style;
+      return style;
+    }
+
+    /**
+     * the page a widget is on. the page Annots arrays are what viewers go by, so P only counts once the Annots of the
+     * page it names list the widget. that's the one page read for most widgets, every page gets read only for a widget
+     * with no P, or a wrong one. P is still the fallback for widgets that are direct objects
+     */
+    long findWidgetPage(PDFParser& reader, const field_node_t& widget, PDFObjectCastPtr<PDFDictionary> widgetDictionary) {
+      long pageOfP = -1;
+      PDFObjectCastPtr<PDFIndirectObjectReference> pageReference = widgetDictionary->QueryDirectObject("P");
+      if(pageReference != NULL) {
+        auto found = pageByObject.find(pageReference->mObjectID);
+        if(found != pageByObject.end()) {
+          pageOfP = found->second;
+        }
+      }
+
+      if(widget.existing) {
+        if(pageOfP >= 0) {
+          readPageAnnotations(pageOfP);
+        }
+
+        auto found = pageByAnnotation.find(widget.id);
+        if(found == pageByAnnotation.end() && !allAnnotatedPagesRead) {
+          for(unsigned long i = 0; i < reader.GetPagesCount(); i++) {
+            readPageAnnotations(i);
+          }
+          allAnnotatedPagesRead = true;
+          found = pageByAnnotation.find(widget.id);
+        }
+
+        if(found != pageByAnnotation.end()) {
+          return found->second;
+        }
+      }
+      return pageOfP;
+    }
+
+    /**
+     * a normal appearance stream of a widget, with its BBox put through its Matrix
+     */
+    void addNormalAppearance(field_node_t& widget, const std::string& state, ObjectIDType id) {
+      PDFObjectCastPtr<PDFStreamInput> stream(objectCache.parse(id));
+      if(stream == NULL) {
+        return;
+      }
+
+      PDFObjectCastPtr<PDFDictionary> streamDictionary(stream->QueryStreamDictionary());
+      PDFObjectCastPtr<PDFArray> bbox = objectCache.query(streamDictionary.GetPtr(), "BBox");
+      if(bbox == NULL || bbox->GetLength() != 4) {
+        return;
+      }
+
+      double matrix[6] = { 1, 0, 0, 1, 0, 0 };
+      PDFObjectCastPtr<PDFArray> matrixArray = objectCache.query(streamDictionary.GetPtr(), "Matrix");
+      if(matrixArray != NULL && matrixArray->GetLength() == 6) {
+        for(unsigned long i = 0; i < 6; i++) {
+          matrix[i] = readRectCoordinate(matrixArray, i);
+        }
+      }
+
+      // the box around the four corners, transformed
+      double left = 0, bottom = 0, right = 0, top = 0;
+      for(int i = 0; i < 4; i++) {
+        double x = readRectCoordinate(bbox, (i & 1) ? 2 : 0);
+        double y = readRectCoordinate(bbox, (i & 2) ? 3 : 1);
+        double tx = matrix[0] * x + matrix[2] * y + matrix[4];
+        double ty = matrix[1] * x + matrix[3] * y + matrix[5];
+        left = i == 0 ? tx : std::min(left, tx);
+        right = i == 0 ? tx : std::max(right, tx);
+        bottom = i == 0 ? ty : std::min(bottom, ty);
+        top = i == 0 ? ty : std::max(top, ty);
+      }
+
+      widget.normalAppearances.push_back({ state, id, PDFRectangle(left, bottom, right, top) });
+    }
+
+    /**
+     * what flattening paints a widget with. its normal appearance streams, by state when there are states, the state
+     * it's in (AS) and its annotation flags (F)
+     */
+    void readNormalAppearances(field_node_t& widget, PDFObjectCastPtr<PDFDictionary> widgetDictionary) {
+      PDFObjectCastPtr<PDFName> state = widgetDictionary->QueryDirectObject("AS");
+      if(state != NULL) {
+        widget.appearanceState = state->GetValue();
+      }
+
+      PDFObjectCastPtr<PDFInteger> flags = widgetDictionary->QueryDirectObject("F");
+      if(flags != NULL) {
+        widget.annotationFlags = flags->GetValue();
+      }
+
+      PDFObjectCastPtr<PDFDictionary> appearance = objectCache.query(widgetDictionary.GetPtr(), "AP");
+      if(appearance == NULL) {
+        return;
+      }
+
+      PDFObjectCastPtr<PDFIndirectObjectReference> normalReference = appearance->QueryDirectObject("N");
+      PDFObjectCastPtr<PDFDictionary> states = objectCache.query(appearance.GetPtr(), "N");
+      if(states == NULL) {
+        // a stream, not a dictionary of states
+        if(normalReference != NULL) {
+          addNormalAppearance(widget, "", normalReference->mObjectID);
+        }
+        return;
+      }
+
+      MapIterator<PDFNameToPDFObjectMap> it = states->GetIterator();
+      while(it.MoveNext()) {
+        if(it.GetValue()->GetType() == PDFObject::ePDFObjectIndirectObjectReference) {
+          addNormalAppearance(widget, it.GetKey()->GetValue(), ((PDFIndirectObjectReference*)it.GetValue())->mObjectID);
+        }
+      }
+    }
+
+    /**
+     * read what flattening needs of every page with widgets of the form on it. only widgets that are objects of their
+     * own can be taken out of Annots, direct ones are left alone
+     */
+    void readWidgetPages(form_template_t& form, PDFParser& reader) {
+      std::map<long, std::unordered_map<ObjectIDType, page_widget_t>> widgetsByPage;
+      for(const field_index_entry_t& entry : form.fieldIndex) {
+        for(const field_node_t* widget : entry.widgets) {
+          if(widget->existing && widget->page >= 0) {
+            long kid = widget == entry.field ? -1 : widget - entry.field->kids.data();
+            widgetsByPage[widget->page][widget->id] = { widget, entry.field, kid };
+          }
+        }
+      }
+
+      for(const auto& pageWidgets : widgetsByPage) {
+        PDFObjectCastPtr<PDFDictionary> pageDictionary(objectCache.page(pageWidgets.first));
+        if(pageDictionary == NULL) {
+          continue;
+        }
+
+        form.pages.push_back(page_t());
+        page_t& page = form.pages.back();
+        page.id = reader.GetPageObjectID(pageWidgets.first);
+        page.entries = readDictionaryEntries(pageDictionary);
+
+        // resources are inherited down the page tree
+        PDFObjectCastPtr<PDFDictionary> resources = objectCache.query(pageDictionary.GetPtr(), "Resources");
+        PDFObjectCastPtr<PDFDictionary> parent = objectCache.query(pageDictionary.GetPtr(), "Parent");
+        for(int depth = 0; resources == NULL && parent != NULL && depth < 64; depth++) {
+          resources = objectCache.query(parent.GetPtr(), "Resources");
+          parent = objectCache.query(parent.GetPtr(), "Parent");
+        }
+
+        if(resources != NULL) {
+          page.resourceEntries = readDictionaryEntries(resources);
+          PDFObjectCastPtr<PDFDictionary> xobjects = objectCache.query(resources.GetPtr(), "XObject");
+          if(xobjects != NULL) {
+            page.xobjectEntries = readDictionaryEntries(xobjects);
+          }
+        }
+
+        // a stream, or an array of them that may be an object of its own
+        PDFObjectCastPtr<PDFArray> contentsArray = objectCache.query(pageDictionary.GetPtr(), "Contents");
+        if(contentsArray != NULL) {
+          SingleValueContainerIterator<PDFObjectVector> it = contentsArray->GetIterator();
+          while(it.MoveNext()) {
+            page.contents.push_back("");
+            pdf_form_serialize::serializeObject(it.GetItem(), page.contents.back());
+          }
+        } else {
+          RefCountPtr<PDFObject> contents(pageDictionary->QueryDirectObject("Contents"));
+          if(contents != NULL) {
+            page.contents.push_back("");
+            pdf_form_serialize::serializeObject(contents.GetPtr(), page.contents.back());
+          }
+        }
+
+        PDFObjectCastPtr<PDFArray> annots = objectCache.query(pageDictionary.GetPtr(), "Annots");
+        if(annots == NULL) {
+          continue;
+        }
+
+        SingleValueContainerIterator<PDFObjectVector> it = annots->GetIterator();
+        while(it.MoveNext()) {
+          ObjectIDType id = 0;
+          if(it.GetItem()->GetType() == PDFObject::ePDFObjectIndirectObjectReference) {
+            id = ((PDFIndirectObjectReference*)it.GetItem())->mObjectID;
+          }
+
+          page.annots.push_back(std::make_pair(id, std::string()));
+          pdf_form_serialize::serializeObject(it.GetItem(), page.annots.back().second);
+
+          auto found = pageWidgets.second.find(id);
+          if(id != 0 && found != pageWidgets.second.end()) {
+            page.widgets.push_back(found->second);
+          }
+        }
+      }
+    }
+
+    /**
+     * the page objects by their ids. the parser has those ids from the page tree already, no page gets parsed here.
+     * StartPDFParsing walked the whole page tree to get them though, so loading still takes longer the more pages
+     * there are
+     */
+    void readPageIds(PDFParser& reader) {
+      pageByObject.reserve(reader.GetPagesCount());
+      for(unsigned long i = 0; i < reader.GetPagesCount(); i++) {
+        pageByObject[reader.GetPageObjectID(i)] = i;
+      }
+    }
+
+    /**
+     * the annotations listed in the Annots of a page, once per page
+     */
+    void readPageAnnotations(long pageIndex) {
+      if(!annotatedPagesRead.insert(pageIndex).second) {
+        return;
+      }
+
+      PDFObjectCastPtr<PDFDictionary> page(objectCache.page(pageIndex));
+      if(page == NULL) {
+        return;
+      }
+
+      PDFObjectCastPtr<PDFArray> annots = objectCache.query(page.GetPtr(), "Annots");
+      if(annots == NULL) {
+        return;
+      }
+
+      SingleValueContainerIterator<PDFObjectVector> it = annots->GetIterator();
+      while(it.MoveNext()) {
+        if(it.GetItem()->GetType() == PDFObject::ePDFObjectIndirectObjectReference) {
+          // an annotation listed on two pages is broken anyway, the page read first keeps it
+          pageByAnnotation.emplace(((PDFIndirectObjectReference*)it.GetItem())->mObjectID, pageIndex);
+        }
+      }
+    }
+
+    /**
+     * index the named fields. the widgets of a field are the field itself when it's merged with its widget,
+     * and its nameless widget kids
+     */
+    void indexFields(form_template_t& form, const std::vector<field_node_t>& fields, std::vector<const field_node_t*>& ancestors) {
+      for(const field_node_t& field : fields) {
+        if(!field.parsed) {
+          continue;
+        }
+
+        if(field.hasName && form.fieldIndexByName.find(field.fullName) == form.fieldIndexByName.end()) {
+          field_index_entry_t entry;
+          entry.field = &field;
+          entry.ancestors = ancestors;
+          if(field.isWidget) {
+            entry.widgets.push_back(&field);
+          }
+          for(const field_node_t& kid : field.kids) {
+            if(kid.parsed && !kid.hasName && kid.isWidget) {
+              entry.widgets.push_back(&kid);
+            }
+          }
+
+          form.fieldIndexByName[field.fullName] = form.fieldIndex.size();
+          form.fieldIndex.push_back(entry);
+        }
+
+        ancestors.push_back(&field);
+        indexFields(form, field.kids, ancestors);
+        ancestors.pop_back();
+      }
+    }
+
+    void writePlanEntries(pdf_form_plan::writer_t& plan, const dictionary_entries_t& entries) {
+      plan.str(entries.bytes);
+      plan.u64(entries.entries.size());
+      for(const dictionary_entry_t& entry : entries.entries) {
+        plan.str(entry.key);
+        plan.u64(entry.size);
+      }
+    }
+
+    /**
+     * entries follow one another, so their sizes are enough to find them again
+     */
+    dictionary_entries_t readPlanEntries(pdf_form_plan::reader_t& plan) {
+      dictionary_entries_t entries;
+      entries.bytes = plan.str();
+      size_t count = plan.count(16);
+      size_t offset = 0;
+      for(size_t i = 0; i < count; i++) {
+        std::string key = plan.str();
+        size_t size = plan.u64();
+        if(size > entries.bytes.size() - offset) {
+          plan.fail();
+          break;
+        }
+        addDictionaryEntry(entries, key, offset, size);
+        offset += size;
+      }
+      if(offset != entries.bytes.size()) {
+        plan.fail();
+      }
+      return entries;
+    }
+
+    void writePlanRectangle(pdf_form_plan::writer_t& plan, const PDFRectangle& rect) {
+      plan.f64(rect.LowerLeftX);
+      plan.f64(rect.LowerLeftY);
+      plan.f64(rect.UpperRightX);
+      plan.f64(rect.UpperRightY);
+    }
+
+    PDFRectangle readPlanRectangle(pdf_form_plan::reader_t& plan) {
+      double lowerLeftX = plan.f64();
+      double lowerLeftY = plan.f64();
+      double upperRightX = plan.f64();
+      double upperRightY = plan.f64();
+      return PDFRectangle(lowerLeftX, lowerLeftY, upperRightX, upperRightY);
+    }
+
+    /**
+     * the nodes of a field tree, parents before their kids. pages point at widgets by their place in this order
+     */
+    void collectPlanNodes(const std::vector<field_node_t>& fields, std::vector<const field_node_t*>& nodes) {
+      for(const field_node_t& field : fields) {
+        nodes.push_back(&field);
+        collectPlanNodes(field.kids, nodes);
+      }
+    }
+
+    /**
+     * a field and its kids. styles and appearances are shared between fields, so they're written once up front and
+     * referred to by index, -1 for none
+     */
+    void writePlanField(pdf_form_plan::writer_t& plan, const field_node_t& field, std::unordered_map<const text_style_t*, size_t>& styles,
+      std::unordered_map<const appearance_t*, size_t>& appearances) {
+      plan.u8(field.existing);
+      plan.u64(field.id);
+      plan.u8(field.parsed);
+      writePlanEntries(plan, field.entries);
+      plan.u8(field.hasName);
+      plan.str(field.fullName);
+      plan.str(field.fieldType);
+      plan.i64(field.flags);
+      plan.str(field.da);
+      plan.i64(field.style != NULL ? (long long)styles[field.style.get()] : -1);
+      plan.i64(field.q);
+      plan.i64(field.maxLen);
+      plan.u64(field.opt.size());
+      for(const std::string& option : field.opt) {
+        plan.str(option);
+      }
+      plan.u8(field.isWidget);
+      plan.u8(field.appearanceInField);
+      plan.u8(field.hasRect);
+      writePlanRectangle(plan, field.rect);
+      plan.i64(field.page);
+      plan.i64(field.appearance != NULL ? (long long)appearances[field.appearance.get()] : -1);
+      plan.str(field.onState);
+      plan.u64(field.normalAppearances.size());
+      for(const normal_appearance_t& appearance : field.normalAppearances) {
+        plan.str(appearance.state);
+        plan.u64(appearance.id);
+        writePlanRectangle(plan, appearance.box);
+      }
+      plan.str(field.appearanceState);
+      plan.i64(field.annotationFlags);
+      plan.u8(field.hasKids);
+      plan.u64(field.kids.size());
+      for(const field_node_t& kid : field.kids) {
+        writePlanField(plan, kid, styles, appearances);
+      }
+    }
+
+    void readPlanField(pdf_form_plan::reader_t& plan, field_node_t& field, const std::vector<std::shared_ptr<const text_style_t>>& styles,
+      const std::vector<std::shared_ptr<const appearance_t>>& appearances, int depth) {
+      // a field tree can't be deeper than the pdf nesting it came out of
+      if(depth > 256) {
+        plan.fail();
+        return;
+      }
+
+      field.existing = plan.u8();
+      field.id = plan.u64();
+      field.parsed = plan.u8();
+      field.entries = readPlanEntries(plan);
+      field.hasName = plan.u8();
+      field.fullName = plan.str();
+      field.fieldType = plan.str();
+      field.flags = plan.i64();
+      field.da = plan.str();
+      long long style = plan.i64();
+      if(style >= 0 && style < (long long)styles.size()) {
+        field.style = styles[style];
+      }
+      field.q = plan.i64();
+      field.maxLen = plan.i64();
+      field.opt.resize(plan.count(8));
+      for(std::string& option : field.opt) {
+        option = plan.str();
+      }
+      field.isWidget = plan.u8();
+      field.appearanceInField = plan.u8();
+      field.hasRect = plan.u8();
+      field.rect = readPlanRectangle(plan);
+      field.page = plan.i64();
+      long long appearance = plan.i64();
+      if(appearance >= 0 && appearance < (long long)appearances.size()) {
+        field.appearance = appearances[appearance];
+      }
+      field.onState = plan.str();
+      field.normalAppearances.resize(plan.count(48));
+      for(normal_appearance_t& normal : field.normalAppearances) {
+        normal.state = plan.str();
+        normal.id = plan.u64();
+        normal.box = readPlanRectangle(plan);
+      }
+      field.appearanceState = plan.str();
+      field.annotationFlags = plan.i64();
+      field.hasKids = plan.u8();
+      field.kids.resize(plan.count(64));
+      for(field_node_t& kid : field.kids) {
+        readPlanField(plan, kid, styles, appearances, depth + 1);
+      }
+      // comes out of opt and the kids, so it isn't in the plan
+      indexExportValues(field);
+    }
+
+    /**
+     * a whole file into out. false if it can't be read, or is empty
+     */
+    static bool readFile(const std::string& path, std::string& out) {
+      InputFile file;
+      if(file.OpenFile(path) != eSuccess) {
+        return false;
+      }
+
+      IOBasicTypes::LongFilePositionType size = file.GetFileSize();
+      out.resize(size);
+      return size > 0 && file.GetInputStream()->Read((IOBasicTypes::Byte*)&out[0], size) == (IOBasicTypes::LongBufferSizeType)size;
+    }
+
+    /**
+     * build the form model out of a parsed pdf
+     */
+    void buildTemplate(form_template_t& form, PDFParser& reader) {
+      // object ids only mean something within one file
+      appearanceCache.clear();
+      drFonts.clear();
+      styleCache.clear();
+      pageByObject.clear();
+      pageByAnnotation.clear();
+      annotatedPagesRead.clear();
+      allAnnotatedPagesRead = false;
+      objectCache.reset(&reader);
+      readPageIds(reader);
+      PDFObjectCastPtr<PDFDictionary> catalogDict = objectCache.query(reader.GetTrailer(), "Root");
+      if(catalogDict == NULL) {
+        throw "Root not found";
+      }
+
+      PDFObjectCastPtr<PDFIndirectObjectReference> catalogReference = reader.GetTrailer()->QueryDirectObject("Root");
+      if(catalogReference != NULL) {
+        form.catalogId = catalogReference->mObjectID;
+      }
+      form.catalogEntries = readDictionaryEntries(catalogDict);
+
+      RefCountPtr<PDFObject> acroformInCatalog(catalogDict->QueryDirectObject("AcroForm"));
+      if(acroformInCatalog == NULL) {
+        throw "AcroForm not found 1";
+      }
+
+      PDFObjectCastPtr<PDFDictionary> acroformDict = objectCache.query(catalogDict.GetPtr(), "AcroForm");
+      if(acroformDict == NULL) {
+        throw "AcroForm not found 2";
+      }
+
+      if(acroformInCatalog->GetType() == PDFObject::ePDFObjectIndirectObjectReference) {
+        form.acroformIndirect = true;
+        form.acroformId = ((PDFIndirectObjectReference*)acroformInCatalog.GetPtr())->mObjectID;
+      }
+      form.acroformEntries = readDictionaryEntries(acroformDict);
+
+      PDFObjectCastPtr<PDFDictionary> dr = objectCache.query(acroformDict.GetPtr(), "DR");
+      if(dr != NULL) {
+        form.drEntries = readDictionaryEntries(dr);
+        readDRFonts(dr);
+
+        PDFObjectCastPtr<PDFIndirectObjectReference> drReference = acroformDict->QueryDirectObject("DR");
+        if(drReference != NULL) {
+          form.drId = drReference->mObjectID;
+        }
+      }
+
+      PDFObjectCastPtr<PDFArray> fields = objectCache.query(acroformDict.GetPtr(), "Fields");
+      if(fields != NULL) {
+        form.hasFields = true;
+        readFields(reader, fields, form.fields, NULL, "");
+      }
+
+      std::vector<const field_node_t*> ancestors;
+      indexFields(form, form.fields, ancestors);
+      readWidgetPages(form, reader);
+
+      appearanceCache.clear();
+      drFonts.clear();
+      styleCache.clear();
+      pageByObject.clear();
+      pageByAnnotation.clear();
+      annotatedPagesRead.clear();
+      form.objectLookups = objectCache.lookups;
+      form.objectCacheHits = objectCache.hits;
+      objectCache.clear();
+    }
+
+    void appendJSONString(const std::string& value, std::string& out) {
+      static const char hex[] = "0123456789abcdef";
+      out += '"';
+      for(unsigned char c : value) {
+        if(c == '"' || c == '\\') {
+          out += '\\';
+          out += c;
+        } else if(c < 0x20) {
+          out += "\\u00";
+          out += hex[c >> 4];
+          out += hex[c & 0xf];
+        } else {
+          out += c;
+        }
+      }
+      out += '"';
+    }
+
+    static double microsSince(std::chrono::steady_clock::time_point start) {
+      return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * where the writer is in its output. it's only reachable through a free context
+     */
+    static long long outputPosition(ObjectsContext& objectsContext) {
+      long long position = objectsContext.StartFreeContext()->GetCurrentPosition();
+      objectsContext.EndFreeContext();
+      return position;
+    }
+
+    /**
+     * fillForm, less the stats hook
+     */
+    fill_stats_t fillDocument(PDFWriter& writer, const form_template_t& form, const std::map<std::string, pdf_value_t>& data, const options_t& options) {
+      ObjectsContext& objectsContext = writer.GetObjectsContext();
+
+      handles_t handles = {
+        .writer = writer,
+        .objectsContext = objectsContext,
+        .data = data,
+        .form = form,
+        .options = options,
+      };
+
+      auto start = std::chrono::steady_clock::now();
+      long long startPosition = outputPosition(objectsContext);
+
+      resolveValues(handles);
+      handles.stats.resolveMicros = microsSince(start);
+
+      auto writeStart = std::chrono::steady_clock::now();
+      writeDocument(handles);
+      handles.stats.writeMicros = microsSince(writeStart);
+
+      handles.stats.bytesWritten = outputPosition(objectsContext) - startPosition;
+      handles.stats.totalMicros = microsSince(start);
+      return handles.stats;
+    }
+
+    /**
+     * write out whatever the resolved values change
+     */
+    void writeDocument(handles_t& handles) {
+      ObjectsContext& objectsContext = handles.objectsContext;
+      const form_template_t& form = handles.form;
+      const options_t& options = handles.options;
+
+      // debug output is printed while laying out, it would come out interleaved
+      if(options.appearanceThreads > 1 && !options.debug) {
+        planAppearancesConcurrently(handles);
+      }
+
+      if(options.flatten) {
+        flattenForm(handles);
+        return;
+      }
+
+      if(options.minimalUpdate) {
+        // the form only has to be rewritten if one of its direct fields changes. otherwise go straight to the fields
+        if(!hasDirtyDirectKid(handles, form.fields)) {
+          for(const field_node_t& field : form.fields) {
+            if(field.existing) {
+              writeTouchedField(handles, field);
+            }
+          }
+          return;
+        }
+      }
+
+      // recreate a copy of the existing form, which we will fill with data.
+      if(form.acroformIndirect) {
+        // if the form is a referenced object, modify it
+        objectsContext.StartModifiedIndirectObject(form.acroformId);
+
+        writeFilledForm(handles, form);
+      } else {
+        // otherwise, recreate the form as an indirect child (this is going to be a general policy, we're making things indirect. it's simpler), and recreate the catalog
+        ObjectIDType newAcroformObjectId = objectsContext.GetInDirectObjectsRegistry().AllocateNewObjectID();
+
+        // recreate the catalog with form pointing to new reference
+        objectsContext.StartModifiedIndirectObject(form.catalogId);
+        DictionaryContext* modifiedCatalogDictionary = startModifiedDictionary(handles, form.catalogEntries, KEY_ACROFORM);
+
+        modifiedCatalogDictionary->WriteKey("AcroForm");
+        modifiedCatalogDictionary->WriteObjectReferenceValue(newAcroformObjectId);
+        objectsContext.EndDictionary(modifiedCatalogDictionary);
+        objectsContext.EndIndirectObject();
+
+        // now create the new form object
+        objectsContext.StartNewIndirectObject(newAcroformObjectId);
+
+        writeFilledForm(handles, form);
+      }
+    }
+
+    /**
+     * fillTemplate, less the stats hook. the caller takes care of the totals
+     */
+    EStatusCode fillTemplateWithStats(const form_template_t& form, const std::map<std::string, pdf_value_t>& data, IByteWriterWithPosition* output, options_t options, fill_stats_t& stats) {
+      return writeDocument(form, output, options, stats, [&](PDFWriter& writer) {
+        stats = fillDocument(writer, form, data, options);
+        return eSuccess;
+      });
+    }
+
+  public:
+    /**
+     * write a document off form into output, with fill filling it in between starting and ending the writer.
+     * with options.fullRewrite it goes into memory first, and is then written out again whole, see pdf_form_rewrite.h.
+     * error, when given, gets which step failed.
+     * ModifyPDFForStream reads the whole xref and page tree of the template for every document, before a byte is
+     * written. so the time to the first byte still grows with the pages of a template, not only with its form
+     */
+    EStatusCode writeDocument(const form_template_t& form, IByteWriterWithPosition* output, const options_t& options, fill_stats_t& stats, const std::function<EStatusCode(PDFWriter& writer)>& fill, std::string* error = NULL) {
+      if(options.fullRewrite) {
+        pdf_form_buffer_sink filled(form.size + form.size / 4);
+        options_t inMemory = options;
+        inMemory.fullRewrite = false;
+        EStatusCode status = writeDocument(form, &filled, inMemory, stats, fill, error);
+        if(status != eSuccess) {
+          return status;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        status = pdf_form_rewrite().rewrite(filled.buffer.data(), filled.buffer.size(), output);
+        stats.rewriteMicros = microsSince(start);
+        if(status != eSuccess && error != NULL) {
+          *error = "failed to rewrite PDF";
+        }
+        return status;
+      }
+
+      PDFWriter writer;
+      InputByteArrayStream source((IOBasicTypes::Byte*)form.data, form.size);
+
+      EStatusCode status = writer.ModifyPDFForStream(&source, output, false, ePDFVersion13);
+      if(status != eSuccess) {
+        if(error != NULL) {
+          *error = "failed to start PDF";
+        }
+        return status;
+      }
+
+      status = fill(writer);
+      if(status != eSuccess) {
+        return status;
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      status = writer.EndPDFForStream();
+      stats.endMicros = microsSince(start);
+      if(status != eSuccess && error != NULL) {
+        *error = "failed to end PDF";
+      }
+      return status;
+    }
+
+    /**
+     * a directory with font files, for writing text in the fonts the DA strings ask for. set before loading templates.
+     * files are looked up by font name, as <name>.ttf, .otf or .ttc
+     */
+    void setFontDirectory(const std::string& path) {
+      fontDirectory = path;
+    }
+
+    /**
+     * parse a template file once, for filling it many times over with fillTemplate/fillBatch
+     */
+    EStatusCode loadTemplate(form_template_t& form, const std::string& path) {
+      if(!readFile(path, form.bytes)) {
+        return eFailure;
+      }
+      return loadTemplate(form, form.bytes.data(), form.bytes.size());
+    }
+
+    /**
+     * parse a template straight out of memory, without copying it. the bytes have to stay there, unchanged, for as long
+     * as the template is in use. a memory mapped file works just as well as a buffer
+     */
+    EStatusCode loadTemplate(form_template_t& form, const char* data, size_t size) {
+      if(data == NULL || size == 0) {
+        return eFailure;
+      }
+
+      form.data = data;
+      form.size = size;
+      form.stream.Assign((IOBasicTypes::Byte*)data, size);
+      if(form.parser.StartPDFParsing(&form.stream) != eSuccess) {
+        return eFailure;
+      }
+
+      buildTemplate(form, form.parser);
+      return eSuccess;
+    }
+
+    /**
+     * compile a loaded template into a fill plan, for loadTemplateWithPlan. see pdf_form_plan.h
+     */
+    std::string compilePlan(const form_template_t& form) {
+      pdf_form_plan::writer_t plan;
+      plan.out.append(pdf_form_plan::MAGIC, strlen(pdf_form_plan::MAGIC) + 1);
+      plan.u64(pdf_form_plan::VERSION);
+      plan.u64(form.size);
+      plan.u64(pdf_form_plan::hash(form.data, form.size));
+
+      plan.u64(form.catalogId);
+      writePlanEntries(plan, form.catalogEntries);
+      plan.u8(form.acroformIndirect);
+      plan.u64(form.acroformId);
+      writePlanEntries(plan, form.acroformEntries);
+      writePlanEntries(plan, form.drEntries);
+      plan.u64(form.drId);
+      plan.u8(form.hasFields);
+
+      std::vector<const field_node_t*> nodes;
+      collectPlanNodes(form.fields, nodes);
+
+      // the shared parts first, in the order the fields first use them
+      std::unordered_map<const text_style_t*, size_t> styles;
+      std::unordered_map<const appearance_t*, size_t> appearances;
+      std::vector<const text_style_t*> styleList;
+      std::vector<const appearance_t*> appearanceList;
+      for(const field_node_t* node : nodes) {
+        if(node->style != NULL && styles.find(node->style.get()) == styles.end()) {
+          styles[node->style.get()] = styleList.size();
+          styleList.push_back(node->style.get());
+        }
+        if(node->appearance != NULL && appearances.find(node->appearance.get()) == appearances.end()) {
+          appearances[node->appearance.get()] = appearanceList.size();
+          appearanceList.push_back(node->appearance.get());
+        }
+      }
+
+      plan.u64(styleList.size());
+      for(const text_style_t* style : styleList) {
+        plan.str(style->fontName);
+        plan.f64(style->fontSize);
+        plan.i64(style->colorSpace);
+        plan.u64(style->colorValue);
+        plan.str(style->colorCode);
+        plan.u64(style->fontId);
+        plan.str(style->fontPath);
+      }
+
+      plan.u64(appearanceList.size());
+      for(const appearance_t* appearance : appearanceList) {
+        plan.str(appearance->before);
+        plan.str(appearance->after);
+      }
+
+      plan.u64(form.fields.size());
+      for(const field_node_t& field : form.fields) {
+        writePlanField(plan, field, styles, appearances);
+      }
+
+      std::unordered_map<const field_node_t*, size_t> nodeIndex;
+      for(size_t i = 0; i < nodes.size(); i++) {
+        nodeIndex[nodes[i]] = i;
+      }
+
+      plan.u64(form.pages.size());
+      for(const page_t& page : form.pages) {
+        plan.u64(page.id);
+        writePlanEntries(plan, page.entries);
+        writePlanEntries(plan, page.resourceEntries);
+        writePlanEntries(plan, page.xobjectEntries);
+        plan.u64(page.contents.size());
+        for(const std::string& contents : page.contents) {
+          plan.str(contents);
+        }
+        plan.u64(page.annots.size());
+        for(const auto& annot : page.annots) {
+          plan.u64(annot.first);
+          plan.str(annot.second);
+        }
+        plan.u64(page.widgets.size());
+        for(const page_widget_t& widget : page.widgets) {
+          plan.u64(nodeIndex[widget.widget]);
+          plan.u64(nodeIndex[widget.field]);
+          plan.i64(widget.kid);
+        }
+      }
+      return plan.out;
+    }
+
+    /**
+     * compile a template into a plan file
+     */
+    EStatusCode savePlan(const form_template_t& form, const std::string& path) {
+      std::string plan = compilePlan(form);
+      OutputFile output;
+      if(output.OpenFile(path) != eSuccess) {
+        return eFailure;
+      }
+
+      IOBasicTypes::LongBufferSizeType written = output.GetOutputStream()->Write((const IOBasicTypes::Byte*)plan.data(), plan.size());
+      output.CloseFile();
+      return written == plan.size() ? eSuccess : eFailure;
+    }
+
+    /**
+     * load a template out of a plan compiled from it, without parsing the pdf at all. the template bytes are still
+     * needed, every fill is an update of them, and are kept the same way loadTemplate keeps them.
+     * fails when the plan was compiled from a different template (or by a different plan format version), the template
+     * has to be compiled again then
+     */
+    EStatusCode loadTemplateWithPlan(form_template_t& form, const char* data, size_t size, const char* planData, size_t planSize) {
+      size_t magicSize = strlen(pdf_form_plan::MAGIC) + 1;
+      if(data == NULL || size == 0 || planData == NULL || planSize < magicSize || memcmp(planData, pdf_form_plan::MAGIC, magicSize) != 0) {
+        return eFailure;
+      }
+
+      pdf_form_plan::reader_t plan(planData + magicSize, planSize - magicSize);
+      if(plan.u64() != pdf_form_plan::VERSION || plan.u64() != size || plan.u64() != pdf_form_plan::hash(data, size)) {
+        return eFailure;
+      }
+
+      form.data = data;
+      form.size = size;
+      form.stream.Assign((IOBasicTypes::Byte*)data, size);
+
+      form.catalogId = plan.u64();
+      form.catalogEntries = readPlanEntries(plan);
+      form.acroformIndirect = plan.u8();
+      form.acroformId = plan.u64();
+      form.acroformEntries = readPlanEntries(plan);
+      form.drEntries = readPlanEntries(plan);
+      form.drId = plan.u64();
+      form.hasFields = plan.u8();
+
+      std::vector<std::shared_ptr<const text_style_t>> styles(plan.count(56));
+      for(std::shared_ptr<const text_style_t>& shared : styles) {
+        std::shared_ptr<text_style_t> style = std::make_shared<text_style_t>();
+        style->fontName = plan.str();
+        style->fontSize = plan.f64();
+        style->colorSpace = (AbstractContentContext::EColorSpace)plan.i64();
+        style->colorValue = plan.u64();
+        style->colorCode = plan.str();
+        style->fontId = plan.u64();
+        style->fontPath = plan.str();
+        if(!style->fontPath.empty()) {
+          style->metrics = pdf_form_font::get(style->fontPath);
+        }
+        shared = style;
+      }
+
+      std::vector<std::shared_ptr<const appearance_t>> appearances(plan.count(16));
+      for(std::shared_ptr<const appearance_t>& shared : appearances) {
+        std::shared_ptr<appearance_t> appearance = std::make_shared<appearance_t>();
+        appearance->before = plan.str();
+        appearance->after = plan.str();
+        shared = appearance;
+      }
+
+      form.fields.resize(plan.count(64));
+      for(field_node_t& field : form.fields) {
+        readPlanField(plan, field, styles, appearances, 0);
+      }
+
+      // the tree is complete, node addresses don't move anymore
+      std::vector<const field_node_t*> nodes;
+      collectPlanNodes(form.fields, nodes);
+
+      form.pages.resize(plan.count(56));
+      for(page_t& page : form.pages) {
+        page.id = plan.u64();
+        page.entries = readPlanEntries(plan);
+        page.resourceEntries = readPlanEntries(plan);
+        page.xobjectEntries = readPlanEntries(plan);
+        page.contents.resize(plan.count(8));
+        for(std::string& contents : page.contents) {
+          contents = plan.str();
+        }
+        page.annots.resize(plan.count(16));
+        for(auto& annot : page.annots) {
+          annot.first = plan.u64();
+          annot.second = plan.str();
+        }
+        page.widgets.resize(plan.count(24));
+        for(page_widget_t& widget : page.widgets) {
+          size_t widgetIndex = plan.u64();
+          size_t fieldIndex = plan.u64();
+          widget.kid = plan.i64();
+          if(widgetIndex >= nodes.size() || fieldIndex >= nodes.size()) {
+            plan.fail();
+            break;
+          }
+          widget.widget = nodes[widgetIndex];
+          widget.field = nodes[fieldIndex];
+        }
+      }
+
+      if(!plan.ok() || !plan.atEnd()) {
+        return eFailure;
+      }
+
+      std::vector<const field_node_t*> ancestors;
+      indexFields(form, form.fields, ancestors);
+      return eSuccess;
+    }
+
+    /**
+     * load a template file with its plan file, see above
+     */
+    EStatusCode loadTemplateWithPlan(form_template_t& form, const std::string& path, const std::string& planPath) {
+      std::string plan;
+      if(!readFile(planPath, plan) || !readFile(path, form.bytes)) {
+        return eFailure;
+      }
+      return loadTemplateWithPlan(form, form.bytes.data(), form.bytes.size(), plan.data(), plan.size());
+    }
+
+    /**
+     * the names in data that the form has no field for
+     */
+    std::vector<std::string> unknownFields(const form_template_t& form, const std::map<std::string, pdf_value_t>& data) {
+      std::vector<std::string> unknown;
+      for(const auto& item : data) {
+        if(form.findField(item.first) == NULL) {
+          unknown.push_back(item.first);
+        }
+      }
+      return unknown;
+    }
+
+    /**
+     * the field index as json. an array of fields, each with its effective (inherited) type, flags, DA, Q and options,
+     * and its widgets with their object ids (null for direct objects), pages (-1 when unknown) and rects
+     */
+    std::string fieldsToJSON(const form_template_t& form) {
+      std::string out = "[";
+      for(size_t i = 0; i < form.fieldIndex.size(); i++) {
+        const field_index_entry_t& entry = form.fieldIndex[i];
+        const field_node_t& field = *entry.field;
+
+        out += i == 0 ? "\n  {" : ",\n  {";
+        out += "\"name\": ";
+        appendJSONString(field.fullName, out);
+        out += ", \"id\": ";
+        out += field.existing ? std::to_string(field.id) : "null";
+        out += ", \"type\": ";
+        appendJSONString(field.fieldType, out);
+        out += ", \"flags\": " + std::to_string(field.flags);
+        out += ", \"da\": ";
+        appendJSONString(field.da, out);
+        out += ", \"q\": " + std::to_string(field.q);
+
+        out += ", \"options\": [";
+        for(size_t j = 0; j < field.opt.size(); j++) {
+          out += j == 0 ? "" : ", ";
+          appendJSONString(field.opt[j], out);
+        }
+
+        out += "], \"widgets\": [";
+        for(size_t j = 0; j < entry.widgets.size(); j++) {
+          const field_node_t& widget = *entry.widgets[j];
+          out += j == 0 ? "{" : ", {";
+          out += "\"id\": ";
+          out += widget.existing ? std::to_string(widget.id) : "null";
+          out += ", \"page\": " + std::to_string(widget.page);
+          if(widget.hasRect) {
+            out += ", \"rect\": [" + pdf_form_serialize::formatNumber(widget.rect.LowerLeftX) + ", " + pdf_form_serialize::formatNumber(widget.rect.LowerLeftY) + ", " +
+              pdf_form_serialize::formatNumber(widget.rect.UpperRightX) + ", " + pdf_form_serialize::formatNumber(widget.rect.UpperRightY) + "]";
+          }
+          out += "}";
+        }
+        out += "]}";
+      }
+      out += form.fieldIndex.empty() ? "]\n" : "\n]\n";
+      return out;
+    }
+
+    fill_stats_t fillForm(PDFWriter& writer, const std::map<std::string, pdf_value_t>& data, options_t options = options_t()) {
+      form_template_t form;
+      buildTemplate(form, writer.GetModifiedFileParser());
+      return fillForm(writer, form, data, options);
+    }
+
+    /**
+     * fill an already parsed template. the writer must be modifying the very same pdf the template was parsed from.
+     * returns what the fill did, which also goes to the stats hook
+     */
+    fill_stats_t fillForm(PDFWriter& writer, const form_template_t& form, const std::map<std::string, pdf_value_t>& data, options_t options = options_t()) {
+      fill_stats_t stats = fillDocument(writer, form, data, options);
+      if(statsHook) {
+        statsHook(stats);
+      }
+      return stats;
+    }
+
+    /**
+     * a function to hand the stats of every fill to, see fill_stats_t. set it before filling, it's called from whatever
+     * thread does the fill
+     */
+    void setStatsHook(stats_hook_t hook) {
+      statsHook = hook;
+    }
+
+    /**
+     * fill a template loaded with loadTemplate into any byte sink (see pdf_form_sink.h for buffers, descriptors and
+     * callbacks). the template bytes are read in place, so nothing but the incremental update is parsed or built per
+     * document. safe to call from many threads on the same template.
+     * stats, when given, gets what the fill did
+     */
+    EStatusCode fillTemplate(const form_template_t& form, const std::map<std::string, pdf_value_t>& data, IByteWriterWithPosition* output, options_t options = options_t(), fill_stats_t* stats = NULL) {
+      fill_stats_t filled;
+      auto start = std::chrono::steady_clock::now();
+      IOBasicTypes::LongFilePositionType startPosition = output->GetCurrentPosition();
+
+      EStatusCode status = fillTemplateWithStats(form, data, output, options, filled);
+
+      filled.bytesWritten = output->GetCurrentPosition() - startPosition;
+      filled.totalMicros = microsSince(start);
+      if(status == eSuccess && statsHook) {
+        statsHook(filled);
+      }
+      if(stats != NULL) {
+        *stats = filled;
+      }
+      return status;
+    }
+
+    /**
+     * fill a template loaded with loadTemplate into a new file
+     */
+    EStatusCode fillTemplate(const form_template_t& form, const std::map<std::string, pdf_value_t>& data, const std::string& outputPath, options_t options = options_t()) {
+      OutputFile output;
+      EStatusCode status = output.OpenFile(outputPath);
+      if(status != eSuccess) {
+        return status;
+      }
+
+      status = fillTemplate(form, data, output.GetOutputStream(), options);
+      output.CloseFile();
+      return status;
+    }
+
+    /**
+     * fill a template once per record, till the source runs dry. stops at the first document that fails
+     */
+    EStatusCode fillBatch(const form_template_t& form, record_source_t nextRecord, options_t options = options_t()) {
+      std::map<std::string, pdf_value_t> data;
+      std::string outputPath;
+
+      while(nextRecord(data, outputPath)) {
+        EStatusCode status = fillTemplate(form, data, outputPath, options);
+        if(status != eSuccess) {
+          return status;
+        }
+        data.clear();
       }
+      return eSuccess;
     }
 };
 
@@ -0,0 +1,144 @@
+#include <chrono>
+
+#include "pdf_form_fill.h"
+#include "pdf_form_bench_forms.h"
+#include "pdf_form_bench_alloc.h"
+
+/**
+ * fill benchmark. builds a synthetic form with lots of text fields, and reports the time and the number of heap
+ * allocations that a fill takes per field. the form is filled without data (just the walk), with a few fields and with every field set,
+ * the latter two both as full and as minimal updates, every field flattened, every field with the appearances laid out on
+ * all cores, and with one value repeated in every field.
+ * then the size and time of whole documents, incremental against fully rewritten, and what building the data map of a
+ * record costs on its own
+ */
+
+/**
+ * fill once, counting the allocations and time the fill itself takes. opening and closing the output isn't counted
+ */
+void measureFill(pdf_form_fill& pff, const pdf_form_fill::form_template_t& form, const std::map<std::string, pdf_form_fill::pdf_value_t>& data, const char* label, size_t fieldCount, pdf_form_fill::options_t options = pdf_form_fill::options_t()) {
+  PDFWriter writer;
+  InputByteArrayStream source((IOBasicTypes::Byte*)form.data, form.size);
+  OutputFile output;
+
+  if(output.OpenFile("pdf_form_fill_bench_out.pdf") != eSuccess ||
+     writer.ModifyPDFForStream(&source, output.GetOutputStream(), false, ePDFVersion13) != eSuccess) {
+    printf("failed to start PDF\n");
+    return;
+  }
+
+  size_t allocationsBefore = allocations;
+  auto start = std::chrono::steady_clock::now();
+
+  pff.fillForm(writer, form, data, options);
+
+  auto end = std::chrono::steady_clock::now();
+  size_t fillAllocations = allocations - allocationsBefore;
+
+  writer.EndPDFForStream();
+  long long outputSize = output.GetOutputStream()->GetCurrentPosition();
+  output.CloseFile();
+
+  double micros = std::chrono::duration<double, std::micro>(end - start).count();
+  printf("%-16s fields=%zu allocations=%zu allocations/field=%.1f time=%.0fus us/field=%.2f output=%lld\n",
+    label, fieldCount, fillAllocations, (double)fillAllocations / fieldCount, micros, micros / fieldCount, outputSize);
+}
+
+/**
+ * a whole document into memory, start to end, as fillTemplate writes it. an incremental update, or with fullRewrite
+ * the update rewritten and compressed. averaged over a few runs
+ */
+void measureOutput(pdf_form_fill& pff, const pdf_form_fill::form_template_t& form, const std::map<std::string, pdf_form_fill::pdf_value_t>& data, const char* label, size_t fieldCount, pdf_form_fill::options_t options) {
+  const int runs = 10;
+  size_t outputSize = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for(int i = 0; i < runs; i++) {
+    pdf_form_buffer_sink output;
+    if(pff.fillTemplate(form, data, &output, options) != eSuccess) {
+      printf("%-16s failed\n", label);
+      return;
+    }
+    outputSize = output.buffer.size();
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  double micros = std::chrono::duration<double, std::micro>(end - start).count() / runs;
+  printf("%-16s fields=%zu time=%.0fus template=%zu output=%zu\n", label, fieldCount, micros, form.size, outputSize);
+}
+
+/**
+ * build the data of one record, short and long texts, a checkbox and a multiple selection, as a reader would
+ */
+void measureData(size_t fieldCount) {
+  size_t allocationsBefore = allocations;
+  auto start = std::chrono::steady_clock::now();
+
+  std::map<std::string, pdf_form_fill::pdf_value_t> data;
+  for(size_t i = 0; i < fieldCount; i += 4) {
+    data.emplace("field" + std::to_string(i), "value " + std::to_string(i));
+    data.emplace("field" + std::to_string(i + 1), std::string("a value long enough to need its own allocation"));
+    data.emplace("field" + std::to_string(i + 2), true);
+    data.emplace("field" + std::to_string(i + 3), std::vector<std::string>({ "one", "two" }));
+  }
+
+  double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  size_t count = allocations - allocationsBefore;
+  printf("%-16s fields=%zu allocations=%zu allocations/field=%.1f time=%.0fus us/field=%.2f value=%zu\n",
+    "build-data", data.size(), count, (double)count / data.size(), micros, micros / data.size(), sizeof(pdf_form_fill::pdf_value_t));
+}
+
+int main(int argc, char** argv) {
+  size_t fieldCount = argc > 1 ? strtoul(argv[1], NULL, 10) : 600;
+  pdf_form_fill pff;
+  pdf_form_fill::form_template_t form;
+
+  std::string templatePath = "pdf_form_fill_bench_template.pdf";
+  if(!writeSyntheticForm(templatePath, fieldCount)) {
+    printf("failed to write %s\n", templatePath.c_str());
+    return 1;
+  }
+
+  if(pff.loadTemplate(form, templatePath) != eSuccess) {
+    printf("failed to load template\n");
+    return 1;
+  }
+
+  std::map<std::string, pdf_form_fill::pdf_value_t> data;
+  pdf_form_fill::options_t defaults, minimal, flatten, threads, rewrite;
+  minimal.minimalUpdate = true;
+  flatten.flatten = true;
+  threads.appearanceThreads = std::thread::hardware_concurrency();
+  rewrite.fullRewrite = true;
+
+  measureFill(pff, form, data, "walk", fieldCount);
+
+  // a few fields out of many, the case minimal updates are for
+  for(size_t i = 0; i < fieldCount; i += 30) {
+    data["field" + std::to_string(i)] = "value " + std::to_string(i);
+  }
+  measureFill(pff, form, data, "fill-some", fieldCount);
+  measureFill(pff, form, data, "fill-some-minimal", fieldCount, minimal);
+
+  for(size_t i = 0; i < fieldCount; i++) {
+    data["field" + std::to_string(i)] = "value " + std::to_string(i);
+  }
+  measureFill(pff, form, data, "fill-all", fieldCount);
+  measureFill(pff, form, data, "fill-all-minimal", fieldCount, minimal);
+  measureFill(pff, form, data, "fill-all-flatten", fieldCount, flatten);
+  measureFill(pff, form, data, "fill-all-threads", fieldCount, threads);
+
+  // what gets stored: the template plus its update, against one compacted document
+  measureOutput(pff, form, data, "out-incremental", fieldCount, defaults);
+  measureOutput(pff, form, data, "out-rewrite", fieldCount, rewrite);
+
+  // one value repeated everywhere. the fields share one appearance stream
+  for(size_t i = 0; i < fieldCount; i++) {
+    data["field" + std::to_string(i)] = "same value";
+  }
+  measureFill(pff, form, data, "fill-same", fieldCount);
+
+  measureData(fieldCount);
+
+  return 0;
+}
@@ -0,0 +1,346 @@
+#ifndef __PDF_FORM_FILL_FARM_H__
+#define __PDF_FORM_FILL_FARM_H__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+
+#include "pdf_form_fill.h"
+#include "pdf_form_template_store.h"
+#include "pdf_form_data.h"
+
+/**
+ * fills many independent documents at once on a pool of worker threads.
+ * every job gets its own PDFWriter (and with it its own parser), while parsed templates are loaded once and shared
+ * by all workers. the form model is read only plain data, so workers never touch each other's pdf objects
+ */
+class pdf_form_fill_farm {
+  public:
+    typedef struct {
+      std::string templatePath;
+      std::map<std::string, pdf_form_fill::pdf_value_t> data;
+      std::string outputPath;
+    } job_t;
+
+    typedef struct {
+      std::string outputPath;
+      EStatusCode status;
+      // why it failed. for a job that succeeded, the values that were left out of it, see pdf_form_data::bind
+      std::string error;
+      // of the whole job, end and rewrite included. bytes written is the size of the output
+      pdf_form_fill::fill_stats_t stats;
+    } job_status_t;
+
+    // called with the index submit() gave a job, and its status, as soon as the job is done
+    typedef std::function<void(size_t index, const job_status_t& status)> status_hook_t;
+
+    // a font to write text appearances with. PDFHummus binds a loaded font to the document writing it, so each job
+    // loads it into its own writer (and subsets it into its own output)
+    typedef struct {
+      std::string path;
+      double size;
+    } font_t;
+
+  private:
+    // jobs queued per worker before submit() waits for them to be taken, so the queue doesn't grow with the input
+    static const size_t JOBS_PER_WORKER = 4;
+
+    typedef struct {
+      std::mutex lock;
+      bool loaded = false;
+      EStatusCode status = eFailure;
+      std::string error;
+      std::shared_ptr<const pdf_form_fill::form_template_t> form;
+    } template_entry_t;
+
+    pdf_form_fill::options_t options;
+    font_t font;
+    std::string fontDirectory;
+    const pdf_form_template_store* store = NULL;
+    pdf_form_fill::stats_hook_t statsHook;
+    status_hook_t statusHook;
+
+    std::mutex templatesLock;
+    std::map<std::string, std::shared_ptr<template_entry_t>> templates;
+
+    std::mutex jobsLock;
+    std::condition_variable jobsReady;
+    std::condition_variable jobsDone;
+    std::condition_variable jobsTaken;
+    std::deque<std::pair<size_t, job_t>> queue;
+    // only kept without a status hook
+    std::vector<job_status_t> statuses;
+    size_t submitted = 0;
+    size_t pending = 0;
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+
+    /**
+     * get a template, parsing it on first use. other templates keep loading while this one parses, only callers
+     * waiting for this very template block on it
+     */
+    std::shared_ptr<template_entry_t> getTemplate(const std::string& path) {
+      std::shared_ptr<template_entry_t> entry;
+      std::string directory;
+      const pdf_form_template_store* templateStore;
+      {
+        std::lock_guard<std::mutex> guard(templatesLock);
+        directory = fontDirectory;
+        templateStore = store;
+        std::shared_ptr<template_entry_t>& found = templates[path];
+        if(!found) {
+          found = std::make_shared<template_entry_t>();
+        }
+        entry = found;
+      }
+
+      std::lock_guard<std::mutex> guard(entry->lock);
+      if(!entry->loaded) {
+        entry->loaded = true;
+
+        const pdf_form_fill::form_template_t* stored = templateStore != NULL ? templateStore->get(path) : NULL;
+        if(stored != NULL) {
+          // the store owns it, and outlives the farm
+          entry->status = eSuccess;
+          entry->form = std::shared_ptr<const pdf_form_fill::form_template_t>(stored, [](const pdf_form_fill::form_template_t*) {});
+          return entry;
+        }
+
+        std::shared_ptr<pdf_form_fill::form_template_t> form = std::make_shared<pdf_form_fill::form_template_t>();
+        entry->form = form;
+        try {
+          pdf_form_fill pff;
+          pff.setFontDirectory(directory);
+          entry->status = pff.loadTemplate(*form, path);
+          if(entry->status != eSuccess) {
+            entry->error = "failed to load template";
+          }
+        } catch(const char* error) {
+          entry->status = eFailure;
+          entry->error = error;
+        } catch(const std::exception& error) {
+          entry->status = eFailure;
+          entry->error = error.what();
+        } catch(...) {
+          entry->status = eFailure;
+          entry->error = "failed to load template";
+        }
+      }
+      return entry;
+    }
+
+    job_status_t runJob(job_t& job) {
+      job_status_t result = { job.outputPath, eSuccess, "" };
+      auto start = std::chrono::steady_clock::now();
+
+      std::shared_ptr<template_entry_t> entry = getTemplate(job.templatePath);
+      if(entry->status != eSuccess) {
+        result.status = entry->status;
+        result.error = entry->error + " " + job.templatePath;
+        return result;
+      }
+      // jobs are submitted before their template is loaded, so their strings get bound to its fields only now
+      result.error = pdf_form_data::bind(*entry->form, job.data);
+
+      pdf_form_fill pff;
+      OutputFile output;
+
+      do {
+        if(output.OpenFile(job.outputPath) != eSuccess) {
+          result.status = eFailure;
+          result.error = "failed to open output";
+          break;
+        }
+
+        std::string error;
+        result.status = pff.writeDocument(*entry->form, output.GetOutputStream(), options, result.stats, [&](PDFWriter& writer) {
+          pdf_form_fill::options_t jobOptions = options;
+          if(font.path.empty()) {
+            result.stats = pff.fillForm(writer, *entry->form, job.data, jobOptions);
+            return eSuccess;
+          }
+
+          PDFUsedFont* usedFont = writer.GetFontForFile(font.path);
+          if(usedFont == NULL) {
+            error = "failed to load font " + font.path;
+            return eFailure;
+          }
+          AbstractContentContext::TextOptions textOptions(usedFont, font.size, AbstractContentContext::eRGB, 0);
+          jobOptions.defaultTextOptions = &textOptions;
+          result.stats = pff.fillForm(writer, *entry->form, job.data, jobOptions);
+          return eSuccess;
+        }, &error);
+        if(result.status != eSuccess) {
+          result.error = error;
+          break;
+        }
+
+        result.stats.bytesWritten = output.GetOutputStream()->GetCurrentPosition();
+        result.stats.totalMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      } while(false);
+
+      output.CloseFile();
+      if(result.status == eSuccess && statsHook) {
+        statsHook(result.stats);
+      }
+      return result;
+    }
+
+    void work() {
+      while(true) {
+        std::pair<size_t, job_t> next;
+        {
+          std::unique_lock<std::mutex> guard(jobsLock);
+          jobsReady.wait(guard, [this] { return stopping || !queue.empty(); });
+          if(queue.empty()) {
+            return;
+          }
+          next = std::move(queue.front());
+          queue.pop_front();
+        }
+        jobsTaken.notify_one();
+
+        job_status_t result;
+        try {
+          result = runJob(next.second);
+        } catch(const char* error) {
+          result = { next.second.outputPath, eFailure, error };
+        } catch(const std::exception& error) {
+          // PDFHummus and the standard library throw these, bad_alloc and all. one job fails, not the whole farm
+          result = { next.second.outputPath, eFailure, error.what() };
+        } catch(...) {
+          result = { next.second.outputPath, eFailure, "unknown error" };
+        }
+
+        status_hook_t hook;
+        {
+          std::lock_guard<std::mutex> guard(jobsLock);
+          hook = statusHook;
+          if(!hook) {
+            statuses[next.first] = result;
+          }
+        }
+        if(hook) {
+          hook(next.first, result);
+        }
+
+        {
+          std::lock_guard<std::mutex> guard(jobsLock);
+          if(--pending == 0) {
+            jobsDone.notify_all();
+          }
+        }
+      }
+    }
+
+  public:
+    pdf_form_fill_farm(size_t workerCount = std::thread::hardware_concurrency(), pdf_form_fill::options_t options = pdf_form_fill::options_t(), font_t font = { "", 0 }) {
+      this->options = options;
+      this->options.defaultTextOptions = NULL;
+      this->options.defaultFontMetrics = NULL;
+      this->font = font;
+
+      // measure with metrics read once for the whole farm. each job still embeds the font in its own document
+      if(!font.path.empty()) {
+        this->options.defaultFontMetrics = pdf_form_font::get(font.path);
+      }
+
+      if(workerCount == 0) {
+        workerCount = 1;
+      }
+      for(size_t i = 0; i < workerCount; i++) {
+        workers.push_back(std::thread(&pdf_form_fill_farm::work, this));
+      }
+    }
+
+    ~pdf_form_fill_farm() {
+      {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        stopping = true;
+      }
+      jobsReady.notify_all();
+      for(std::thread& worker : workers) {
+        worker.join();
+      }
+    }
+
+    pdf_form_fill_farm(const pdf_form_fill_farm&) = delete;
+    pdf_form_fill_farm& operator=(const pdf_form_fill_farm&) = delete;
+
+    /**
+     * where templates look for the fonts their DA strings name, see pdf_form_fill::setFontDirectory.
+     * set it before submitting jobs, templates already loaded keep the fonts they found
+     */
+    void setFontDirectory(const std::string& path) {
+      std::lock_guard<std::mutex> guard(templatesLock);
+      fontDirectory = path;
+    }
+
+    /**
+     * take templates out of a store loaded up front, by the job templatePath as the store name. templates the store
+     * doesn't have are still loaded from their path. the store has to outlive the farm, set it before submitting jobs
+     */
+    void setTemplateStore(const pdf_form_template_store* store) {
+      std::lock_guard<std::mutex> guard(templatesLock);
+      this->store = store;
+    }
+
+    /**
+     * a function to hand the stats of every job that succeeded to, see pdf_form_fill::fill_stats_t. it's called from
+     * the worker threads, at once from several of them. set it before submitting jobs
+     */
+    void setStatsHook(pdf_form_fill::stats_hook_t hook) {
+      std::lock_guard<std::mutex> guard(jobsLock);
+      statsHook = hook;
+    }
+
+    /**
+     * a function to hand the status of every job to as soon as it's done, instead of keeping them all for wait(). with
+     * it the farm holds nothing of a job once it's done, so any number of them can go through. it's called from the
+     * worker threads, at once from several of them. set it before submitting jobs
+     */
+    void setStatusHook(status_hook_t hook) {
+      std::lock_guard<std::mutex> guard(jobsLock);
+      statusHook = hook;
+    }
+
+    /**
+     * queue a job, waiting first while JOBS_PER_WORKER jobs per worker are already queued. returns its index, in the
+     * statuses wait() hands back or as given to the status hook
+     */
+    size_t submit(job_t job) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> guard(jobsLock);
+        jobsTaken.wait(guard, [this] { return queue.size() < JOBS_PER_WORKER * workers.size(); });
+        index = submitted++;
+        if(!statusHook) {
+          statuses.push_back({ job.outputPath, eFailure, "not run" });
+        }
+        queue.push_back(std::make_pair(index, std::move(job)));
+        pending++;
+      }
+      jobsReady.notify_one();
+      return index;
+    }
+
+    /**
+     * wait for every job submitted so far, and hand back their statuses in submission order, none with a status hook.
+     * the farm is then ready for a new round of jobs
+     */
+    std::vector<job_status_t> wait() {
+      std::unique_lock<std::mutex> guard(jobsLock);
+      jobsDone.wait(guard, [this] { return pending == 0; });
+
+      std::vector<job_status_t> done;
+      done.swap(statuses);
+      submitted = 0;
+      return done;
+    }
+};
+
+#endif //__PDF_FORM_FILL_FARM_H__
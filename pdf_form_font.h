@@ -0,0 +1,188 @@
+#ifndef __PDF_FORM_FONT_H__
+#define __PDF_FORM_FONT_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "EStatusCode.h"
+#include "PDFUsedFont.h"
+#include "FreeTypeWrapper.h"
+
+/**
+ * glyph metrics of a font file, loaded once per process and shared by every fill and thread. advance widths are kept in
+ * a flat table by code point, so measuring text is a loop over its characters with no freetype calls involved.
+ * writing the text still needs the font loaded into the document (PDFWriter::GetFontForFile). that's a single font
+ * object and subset per document, which every appearance written with it refers to
+ */
+class pdf_form_font {
+  private:
+    // in thousandths of the font size, like pdf glyph space
+    typedef struct {
+      float advance;
+      float yMin;
+      float yMax;
+    } glyph_metrics_t;
+
+    // the basic multilingual plane, so a table is 64k entries at most. anything above measures as the missing glyph
+    static const uint32_t MAX_CODE_POINT = 0xFFFF;
+
+    std::vector<glyph_metrics_t> glyphs;
+    glyph_metrics_t missing = { 0, 0, 0 };
+    double ascent = 0;
+    double descent = 0;
+
+    pdf_form_font() {}
+
+    glyph_metrics_t readGlyph(FT_Face face, FT_UInt glyphIndex, double scale) {
+      glyph_metrics_t glyph = { 0, 0, 0 };
+      if(FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_SCALE) == 0) {
+        glyph.advance = face->glyph->metrics.horiAdvance * scale;
+        glyph.yMax = face->glyph->metrics.horiBearingY * scale;
+        glyph.yMin = (face->glyph->metrics.horiBearingY - face->glyph->metrics.height) * scale;
+      }
+      return glyph;
+    }
+
+    EStatusCode load(const std::string& path) {
+      FreeTypeWrapper freeType;
+      FT_Face face = freeType.NewFace(path, 0);
+      if(face == NULL) {
+        return eFailure;
+      }
+
+      if(face->units_per_EM == 0 || FT_Select_Charmap(face, FT_ENCODING_UNICODE) != 0) {
+        // bitmap fonts have no outlines to measure, and without a unicode map there's nothing to index by
+        freeType.DoneFace(face);
+        return eFailure;
+      }
+
+      double scale = 1000.0 / face->units_per_EM;
+      ascent = face->ascender * scale;
+      descent = face->descender * scale;
+      missing = readGlyph(face, 0, scale);
+
+      FT_UInt glyphIndex = 0;
+      FT_ULong codePoint = FT_Get_First_Char(face, &glyphIndex);
+      while(glyphIndex != 0) {
+        if(codePoint <= MAX_CODE_POINT) {
+          if(codePoint >= glyphs.size()) {
+            glyphs.resize(codePoint + 1, missing);
+          }
+          glyphs[codePoint] = readGlyph(face, glyphIndex, scale);
+        }
+        codePoint = FT_Get_Next_Char(face, codePoint, &glyphIndex);
+      }
+
+      freeType.DoneFace(face);
+      return eSuccess;
+    }
+
+    const glyph_metrics_t& getGlyph(uint32_t codePoint) const {
+      return codePoint < glyphs.size() ? glyphs[codePoint] : missing;
+    }
+
+  public:
+    pdf_form_font(const pdf_form_font&) = delete;
+    pdf_form_font& operator=(const pdf_form_font&) = delete;
+
+    /**
+     * decode the utf8 character at index, and move index past it. broken sequences decode as single bytes
+     */
+    static uint32_t nextCodePoint(const std::string& text, size_t& index) {
+      unsigned char lead = text[index++];
+      int length = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+      uint32_t codePoint = length == 0 ? lead : lead & (0x3F >> length);
+
+      for(int i = 0; i < length; i++) {
+        if(index >= text.size() || ((unsigned char)text[index] & 0xC0) != 0x80) {
+          return lead;
+        }
+        codePoint = (codePoint << 6) | ((unsigned char)text[index++] & 0x3F);
+      }
+      return codePoint;
+    }
+
+    /**
+     * the metrics of a font file, read the first time it's asked for and kept for the life of the process.
+     * NULL if the file can't be loaded, which is remembered as well
+     */
+    static const pdf_form_font* get(const std::string& path) {
+      static std::mutex lock;
+      static std::map<std::string, std::unique_ptr<pdf_form_font>> fonts;
+
+      std::lock_guard<std::mutex> guard(lock);
+      auto found = fonts.find(path);
+      if(found != fonts.end()) {
+        return found->second.get();
+      }
+
+      std::unique_ptr<pdf_form_font> font(new pdf_form_font());
+      if(font->load(path) != eSuccess) {
+        // remembered as missing, so a bad path costs one attempt and not one per lookup
+        font.reset();
+      }
+      return (fonts[path] = std::move(font)).get();
+    }
+
+    // in thousandths of the font size. descent is negative
+    double getAscent() const {
+      return ascent;
+    }
+
+    double getDescent() const {
+      return descent;
+    }
+
+    // advance of a single character, in thousandths of the font size
+    double getAdvance(uint32_t codePoint) const {
+      return getGlyph(codePoint).advance;
+    }
+
+    /**
+     * width of utf8 text at a font size
+     */
+    double getTextAdvance(const std::string& text, double fontSize) const {
+      double advance = 0;
+      for(size_t i = 0; i < text.size(); ) {
+        advance += getGlyph(nextCodePoint(text, i)).advance;
+      }
+      return advance * fontSize / 1000;
+    }
+
+    /**
+     * same as PDFUsedFont::CalculateTextDimensions, with the box running from the pen start to the advance of the text
+     */
+    PDFUsedFont::TextMeasures calculateTextDimensions(const std::string& text, double fontSize) const {
+      PDFUsedFont::TextMeasures measures = { 0, 0, 0, 0, 0, 0 };
+      double advance = 0;
+      double yMin = 0;
+      double yMax = 0;
+      bool first = true;
+
+      for(size_t i = 0; i < text.size(); ) {
+        const glyph_metrics_t& glyph = getGlyph(nextCodePoint(text, i));
+        advance += glyph.advance;
+        if(first || glyph.yMin < yMin) {
+          yMin = glyph.yMin;
+        }
+        if(first || glyph.yMax > yMax) {
+          yMax = glyph.yMax;
+        }
+        first = false;
+      }
+
+      double scale = fontSize / 1000;
+      measures.yMin = yMin * scale;
+      measures.xMax = advance * scale;
+      measures.yMax = yMax * scale;
+      measures.width = measures.xMax;
+      measures.height = measures.yMax - measures.yMin;
+      return measures;
+    }
+};
+
+#endif //__PDF_FORM_FONT_H__
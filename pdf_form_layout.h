@@ -0,0 +1,299 @@
+#ifndef __PDF_FORM_LAYOUT_H__
+#define __PDF_FORM_LAYOUT_H__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "pdf_form_font.h"
+
+/**
+ * lays out the text of a text field appearance: a single line, word wrapped lines for multiline fields, or one character
+ * per cell for comb fields. a font size of 0 gets fitted to the box.
+ * the text is measured once, character by character, and everything after works on sums of those widths. so fitting
+ * the size and wrapping never go back to the font
+ */
+class pdf_form_layout {
+  public:
+    /**
+     * text measured at a font size of 1. one advance per character, with the byte offset it starts at in the utf8
+     * text (and one more offset for the end of the text)
+     */
+    typedef struct {
+      std::string text;
+      std::vector<size_t> offsets;
+      std::vector<double> advances;
+      double ascent;
+      double descent; // negative
+    } measured_text_t;
+
+    typedef struct {
+      double width;
+      double height;
+      double fontSize; // 0 is auto
+      long long quad;
+      bool multiline;
+      bool comb;
+      long long maxLen; // 0 for none
+    } box_t;
+
+    // a run of text, positioned by its baseline start
+    typedef struct {
+      std::string text;
+      double x;
+      double y;
+    } line_t;
+
+    typedef struct {
+      double fontSize;
+      std::vector<line_t> lines;
+    } layout_t;
+
+    // space left between the box border and the text, and the limits of auto sizing
+    static constexpr double PADDING = 2;
+    static constexpr double MAX_AUTO_SIZE = 12;
+    static constexpr double MIN_AUTO_SIZE = 4;
+
+    /**
+     * measure text with the cached metrics of a font
+     */
+    static measured_text_t measure(const pdf_form_font& font, const std::string& text) {
+      measured_text_t measured;
+      measured.text = text;
+      measured.offsets.reserve(text.size() + 1);
+      measured.advances.reserve(text.size());
+      measured.ascent = font.getAscent() / 1000;
+      measured.descent = font.getDescent() / 1000;
+
+      for(size_t i = 0; i < text.size(); ) {
+        measured.offsets.push_back(i);
+        measured.advances.push_back(font.getAdvance(pdf_form_font::nextCodePoint(text, i)) / 1000);
+      }
+      measured.offsets.push_back(text.size());
+      return measured;
+    }
+
+    /**
+     * the largest size a line of lineHeight (at size 1) fits the box height with, capped like viewers do auto sizes
+     */
+    static double fitToHeight(double boxHeight, double lineHeight) {
+      double fontSize = (boxHeight - 2 * PADDING) / (lineHeight > 0 ? lineHeight : 1);
+      return std::max(1.0, std::min(MAX_AUTO_SIZE, fontSize));
+    }
+
+    static layout_t layoutText(const measured_text_t& source, const box_t& box) {
+      const measured_text_t* measured = &source;
+      measured_text_t truncated;
+      if(box.maxLen > 0 && (size_t)box.maxLen < source.advances.size()) {
+        truncated = truncate(source, box.maxLen);
+        measured = &truncated;
+      }
+
+      if(box.comb && box.maxLen > 0 && !box.multiline) {
+        return layoutComb(*measured, box);
+      }
+
+      if(box.multiline) {
+        return layoutMultiline(*measured, box);
+      }
+      return layoutSingleLine(*measured, box);
+    }
+
+  private:
+    typedef std::pair<size_t, size_t> range_t;
+
+    static measured_text_t truncate(const measured_text_t& measured, long long maxLen) {
+      measured_text_t truncated;
+      truncated.text = measured.text.substr(0, measured.offsets[maxLen]);
+      truncated.offsets.assign(measured.offsets.begin(), measured.offsets.begin() + maxLen + 1);
+      truncated.advances.assign(measured.advances.begin(), measured.advances.begin() + maxLen);
+      truncated.ascent = measured.ascent;
+      truncated.descent = measured.descent;
+      return truncated;
+    }
+
+    static std::string substring(const measured_text_t& measured, const range_t& range) {
+      return measured.text.substr(measured.offsets[range.first], measured.offsets[range.second] - measured.offsets[range.first]);
+    }
+
+    static bool isCharacter(const measured_text_t& measured, size_t index, char c) {
+      return measured.offsets[index + 1] - measured.offsets[index] == 1 && measured.text[measured.offsets[index]] == c;
+    }
+
+    static double alignedX(const box_t& box, double lineWidth) {
+      switch(box.quad) {
+        case 1:
+          return (box.width - lineWidth) / 2;
+        case 2:
+          return box.width - PADDING - lineWidth;
+        default:
+          return PADDING;
+      }
+    }
+
+    // baseline that centers a line vertically in the box
+    static double centeredBaseline(const measured_text_t& measured, const box_t& box, double fontSize) {
+      return (box.height - (measured.ascent - measured.descent) * fontSize) / 2 - measured.descent * fontSize;
+    }
+
+    static layout_t layoutSingleLine(const measured_text_t& measured, const box_t& box) {
+      double width = 0;
+      for(double advance : measured.advances) {
+        width += advance;
+      }
+
+      layout_t layout;
+      layout.fontSize = box.fontSize;
+      if(layout.fontSize <= 0) {
+        layout.fontSize = fitToHeight(box.height, measured.ascent - measured.descent);
+        if(width * layout.fontSize > box.width - 2 * PADDING) {
+          layout.fontSize = std::max(1.0, (box.width - 2 * PADDING) / width);
+        }
+      }
+
+      // a single line has no use for line breaks
+      std::string text = measured.text;
+      std::replace(text.begin(), text.end(), '\r', ' ');
+      std::replace(text.begin(), text.end(), '\n', ' ');
+
+      layout.lines.push_back({ text, alignedX(box, width * layout.fontSize), centeredBaseline(measured, box, layout.fontSize) });
+      return layout;
+    }
+
+    static layout_t layoutComb(const measured_text_t& measured, const box_t& box) {
+      double cellWidth = box.width / box.maxLen;
+
+      layout_t layout;
+      layout.fontSize = box.fontSize;
+      if(layout.fontSize <= 0) {
+        double widest = 0;
+        for(double advance : measured.advances) {
+          widest = std::max(widest, advance);
+        }
+        layout.fontSize = fitToHeight(box.height, measured.ascent - measured.descent);
+        if(widest * layout.fontSize > cellWidth) {
+          layout.fontSize = std::max(1.0, cellWidth / widest);
+        }
+      }
+
+      double y = centeredBaseline(measured, box, layout.fontSize);
+      for(size_t i = 0; i < measured.advances.size(); i++) {
+        double x = i * cellWidth + (cellWidth - measured.advances[i] * layout.fontSize) / 2;
+        layout.lines.push_back({ substring(measured, range_t(i, i + 1)), x, y });
+      }
+      return layout;
+    }
+
+    /**
+     * break the text into lines no wider than maxWidth (at size 1), at spaces where possible and at line breaks always.
+     * prefix holds the sums of the advances and nextBreak the next line break from every character, so finding the end of a
+     * line is a binary search
+     */
+    static void wrap(const measured_text_t& measured, const std::vector<double>& prefix, const std::vector<size_t>& nextBreak, double maxWidth, std::vector<range_t>& lines) {
+      size_t count = measured.advances.size();
+      size_t start = 0;
+      lines.clear();
+      // a box narrower than its padding still gets a character a line
+      maxWidth = std::max(0.0, maxWidth);
+
+      while(true) {
+        size_t paragraphEnd = nextBreak[start];
+
+        // the furthest the line can go within its paragraph
+        size_t end = std::upper_bound(prefix.begin() + start, prefix.begin() + paragraphEnd + 1, prefix[start] + maxWidth) - prefix.begin() - 1;
+        if(end == start && start < paragraphEnd) {
+          // not even one character fits. it gets a line of its own anyway
+          end = start + 1;
+        }
+
+        if(end >= paragraphEnd) {
+          lines.push_back(range_t(start, paragraphEnd));
+          if(paragraphEnd >= count) {
+            break;
+          }
+
+          start = paragraphEnd + 1;
+          if(isCharacter(measured, paragraphEnd, '\r') && start < count && isCharacter(measured, start, '\n')) {
+            start++;
+          }
+          continue;
+        }
+
+        // back off to the last space that fits
+        size_t space = end;
+        while(space > start && !isCharacter(measured, space, ' ')) {
+          space--;
+        }
+
+        if(space > start) {
+          lines.push_back(range_t(start, space));
+          start = space + 1;
+          while(start < paragraphEnd && isCharacter(measured, start, ' ')) {
+            start++;
+          }
+        } else {
+          // a word longer than the line. break it wherever it stops fitting
+          lines.push_back(range_t(start, end));
+          start = end;
+        }
+      }
+    }
+
+    static layout_t layoutMultiline(const measured_text_t& measured, const box_t& box) {
+      size_t count = measured.advances.size();
+      std::vector<double> prefix(count + 1, 0);
+      for(size_t i = 0; i < count; i++) {
+        prefix[i + 1] = prefix[i] + measured.advances[i];
+      }
+
+      std::vector<size_t> nextBreak(count + 1, count);
+      for(size_t i = count; i-- > 0; ) {
+        nextBreak[i] = (isCharacter(measured, i, '\n') || isCharacter(measured, i, '\r')) ? i : nextBreak[i + 1];
+      }
+
+      double lineHeight = measured.ascent - measured.descent;
+      double availableWidth = std::max(0.0, box.width - 2 * PADDING);
+      double availableHeight = box.height - 2 * PADDING;
+      std::vector<range_t> lines;
+
+      layout_t layout;
+      layout.fontSize = box.fontSize;
+      if(layout.fontSize <= 0) {
+        // the largest size whose wrapped lines still fit the height. the line count only grows with the size
+        double low = MIN_AUTO_SIZE;
+        double high = std::max(MIN_AUTO_SIZE, std::min(MAX_AUTO_SIZE, availableHeight / (lineHeight > 0 ? lineHeight : 1)));
+        wrap(measured, prefix, nextBreak, availableWidth / high, lines);
+        if(lines.size() * lineHeight * high <= availableHeight) {
+          low = high;
+        } else {
+          while(high - low > 0.1) {
+            double middle = (low + high) / 2;
+            wrap(measured, prefix, nextBreak, availableWidth / middle, lines);
+            if(lines.size() * lineHeight * middle <= availableHeight) {
+              low = middle;
+            } else {
+              high = middle;
+            }
+          }
+        }
+        layout.fontSize = low;
+      }
+
+      wrap(measured, prefix, nextBreak, availableWidth / layout.fontSize, lines);
+
+      double y = box.height - PADDING - measured.ascent * layout.fontSize;
+      for(const range_t& line : lines) {
+        range_t trimmed = line;
+        while(trimmed.second > trimmed.first && isCharacter(measured, trimmed.second - 1, ' ')) {
+          trimmed.second--;
+        }
+
+        double width = (prefix[trimmed.second] - prefix[trimmed.first]) * layout.fontSize;
+        layout.lines.push_back({ substring(measured, trimmed), alignedX(box, width), y });
+        y -= lineHeight * layout.fontSize;
+      }
+      return layout;
+    }
+};
+
+#endif //__PDF_FORM_LAYOUT_H__
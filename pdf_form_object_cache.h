@@ -0,0 +1,127 @@
+#ifndef __PDF_FORM_OBJECT_CACHE_H__
+#define __PDF_FORM_OBJECT_CACHE_H__
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "PDFParser.h"
+#include "PDFObject.h"
+#include "PDFDictionary.h"
+#include "PDFArray.h"
+#include "PDFIndirectObjectReference.h"
+#include "RefCountPtr.h"
+
+/**
+ * indirect objects of one parsed pdf, each parsed once. PDFParser parses an object anew every time it's asked for it,
+ * and reading a form asks for the same ones over and over: the AP and N of a widget, the appearance streams the kids of
+ * a radio share, the Pages node above every page, the DR fonts.
+ * holds the capacity most recently used objects, the least recently used go first. lookups and hits are counted, so
+ * how much it saves on a form can be seen.
+ * everything it returns comes with a reference of its own, like what PDFParser returns, so it goes into a RefCountPtr
+ * or PDFObjectCastPtr the same way
+ */
+class pdf_form_object_cache {
+  public:
+    static const size_t DEFAULT_CAPACITY = 4096;
+
+  private:
+    typedef struct {
+      RefCountPtr<PDFObject> object;
+      std::list<ObjectIDType>::iterator use;
+    } cached_t;
+
+    PDFParser* reader = NULL;
+    size_t capacity = DEFAULT_CAPACITY;
+    // most recently used first
+    std::list<ObjectIDType> uses;
+    std::unordered_map<ObjectIDType, cached_t> objects;
+
+    static PDFObject* share(PDFObject* object) {
+      if(object != NULL) {
+        object->AddRef();
+      }
+      return object;
+    }
+
+  public:
+    size_t lookups = 0;
+    size_t hits = 0;
+
+    /**
+     * start over on another parser, with the counts back at 0
+     */
+    void reset(PDFParser* parser, size_t maxObjects = DEFAULT_CAPACITY) {
+      clear();
+      reader = parser;
+      capacity = maxObjects > 0 ? maxObjects : 1;
+      lookups = 0;
+      hits = 0;
+    }
+
+    /**
+     * let go of every object, the counts stay
+     */
+    void clear() {
+      objects.clear();
+      uses.clear();
+    }
+
+    PDFObject* parse(ObjectIDType id) {
+      lookups++;
+      auto found = objects.find(id);
+      if(found != objects.end()) {
+        hits++;
+        uses.splice(uses.begin(), uses, found->second.use);
+        return share(found->second.object.GetPtr());
+      }
+
+      RefCountPtr<PDFObject> object(reader->ParseNewObject(id));
+      if(object == NULL) {
+        return NULL;
+      }
+
+      if(objects.size() >= capacity) {
+        objects.erase(uses.back());
+        uses.pop_back();
+      }
+      uses.push_front(id);
+      objects[id] = { object, uses.begin() };
+      return share(object.GetPtr());
+    }
+
+    /**
+     * the object a reference points at, or the object itself when it's a direct one
+     */
+    PDFObject* resolve(PDFObject* object) {
+      if(object != NULL && object->GetType() == PDFObject::ePDFObjectIndirectObjectReference) {
+        return parse(((PDFIndirectObjectReference*)object)->mObjectID);
+      }
+      return share(object);
+    }
+
+    PDFObject* query(PDFDictionary* dictionary, const std::string& key) {
+      if(dictionary == NULL) {
+        return NULL;
+      }
+      RefCountPtr<PDFObject> object(dictionary->QueryDirectObject(key));
+      return resolve(object.GetPtr());
+    }
+
+    PDFObject* query(PDFArray* array, unsigned long index) {
+      if(array == NULL || index >= array->GetLength()) {
+        return NULL;
+      }
+      RefCountPtr<PDFObject> object(array->QueryObject(index));
+      return resolve(object.GetPtr());
+    }
+
+    PDFObject* page(unsigned long index) {
+      if(index >= reader->GetPagesCount()) {
+        return NULL;
+      }
+      return parse(reader->GetPageObjectID(index));
+    }
+};
+
+#endif //__PDF_FORM_OBJECT_CACHE_H__
@@ -0,0 +1,154 @@
+#ifndef __PDF_FORM_PLAN_H__
+#define __PDF_FORM_PLAN_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+/**
+ * the binary format of a compiled template (see pdf_form_fill::compilePlan). a plan is the form model of a template
+ * written out: every dictionary already serialized, keyed for the entries a fill replaces, the appearance prefixes and
+ * suffixes, BBoxes and the object ids. loading one skips parsing the pdf altogether.
+ * numbers are little endian whatever the machine, strings are their length and bytes. the header holds the size and
+ * hash of the template the plan was compiled from, a plan that doesn't match the template it's loaded with is refused
+ */
+class pdf_form_plan {
+  public:
+    static constexpr const char* MAGIC = "PFFPLAN";
+    // bump whenever the layout of the form model changes, older plans get refused and have to be compiled again
+    static const uint32_t VERSION = 3;
+
+    /**
+     * FNV-1a over the template bytes, eight at a time
+     */
+    static uint64_t hash(const char* data, size_t size) {
+      uint64_t value = 14695981039346656037ULL;
+      size_t i = 0;
+      for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        value = (value ^ word) * 1099511628211ULL;
+      }
+      for(; i < size; i++) {
+        value = (value ^ (unsigned char)data[i]) * 1099511628211ULL;
+      }
+      return value;
+    }
+
+    class writer_t {
+      public:
+        std::string out;
+
+        void u8(uint8_t value) {
+          out += (char)value;
+        }
+
+        void u64(uint64_t value) {
+          for(int i = 0; i < 8; i++) {
+            out += (char)((value >> (i * 8)) & 0xFF);
+          }
+        }
+
+        void i64(long long value) {
+          u64((uint64_t)value);
+        }
+
+        void f64(double value) {
+          uint64_t bits;
+          memcpy(&bits, &value, 8);
+          u64(bits);
+        }
+
+        void str(const std::string& value) {
+          u64(value.size());
+          out += value;
+        }
+    };
+
+    /**
+     * reads a plan back. reading past the end, or a count that can't fit in what's left, fails the reader and reads 0
+     * and "" from then on, so a truncated or corrupt plan is caught by checking ok() once at the end
+     */
+    class reader_t {
+      private:
+        const char* data;
+        size_t size;
+        size_t position = 0;
+        bool failed = false;
+
+        bool take(size_t length) {
+          if(failed || length > size - position) {
+            failed = true;
+            return false;
+          }
+          return true;
+        }
+
+      public:
+        reader_t(const char* data, size_t size) : data(data), size(size) {}
+
+        uint8_t u8() {
+          if(!take(1)) {
+            return 0;
+          }
+          return (uint8_t)data[position++];
+        }
+
+        uint64_t u64() {
+          if(!take(8)) {
+            return 0;
+          }
+          uint64_t value = 0;
+          for(int i = 0; i < 8; i++) {
+            value |= (uint64_t)(unsigned char)data[position++] << (i * 8);
+          }
+          return value;
+        }
+
+        long long i64() {
+          return (long long)u64();
+        }
+
+        double f64() {
+          uint64_t bits = u64();
+          double value;
+          memcpy(&value, &bits, 8);
+          return value;
+        }
+
+        std::string str() {
+          size_t length = u64();
+          if(!take(length)) {
+            return "";
+          }
+          std::string value(data + position, length);
+          position += length;
+          return value;
+        }
+
+        /**
+         * a count of items that take at least itemSize bytes each
+         */
+        size_t count(size_t itemSize) {
+          size_t value = u64();
+          if(!failed && value > (size - position) / (itemSize > 0 ? itemSize : 1)) {
+            failed = true;
+          }
+          return failed ? 0 : value;
+        }
+
+        void fail() {
+          failed = true;
+        }
+
+        bool ok() const {
+          return !failed;
+        }
+
+        bool atEnd() const {
+          return position == size;
+        }
+    };
+};
+
+#endif //__PDF_FORM_PLAN_H__
@@ -0,0 +1,358 @@
+#ifndef __PDF_FORM_REWRITE_H__
+#define __PDF_FORM_REWRITE_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+#include "PDFParser.h"
+#include "PDFObjectCast.h"
+#include "PDFDictionary.h"
+#include "PDFArray.h"
+#include "PDFName.h"
+#include "PDFInteger.h"
+#include "PDFReal.h"
+#include "PDFBoolean.h"
+#include "PDFLiteralString.h"
+#include "PDFHexString.h"
+#include "PDFIndirectObjectReference.h"
+#include "PDFStreamInput.h"
+#include "ParsedPrimitiveHelper.h"
+#include "InputByteArrayStream.h"
+#include "OutputStringBufferStream.h"
+#include "OutputFlateEncodeStream.h"
+#include "IByteWriterWithPosition.h"
+#include "RefCountPtr.h"
+#include "EStatusCode.h"
+
+#include "pdf_form_serialize.h"
+
+/**
+ * writes a pdf out again from scratch, instead of adding yet another incremental update to it.
+ * only the latest revision of each object is there to begin with, and only what the trailer Root and Info lead to is
+ * written, so superseded and unreachable objects are gone. objects get numbered anew, from 1 up.
+ * streams are copied as they are, still encoded. everything else is packed into flate compressed object streams,
+ * and the cross reference table is a compressed stream too, so the result is pdf 1.5 at least.
+ * encrypted files aren't rewritten
+ */
+class pdf_form_rewrite {
+  public:
+    // objects packed into each object stream
+    static const size_t OBJECTS_PER_STREAM = 100;
+
+  private:
+    typedef struct {
+      ObjectIDType source;
+      RefCountPtr<PDFObject> object;
+      ObjectIDType id; // 0 when the source object isn't there
+    } object_t;
+
+    // a cross reference stream entry: 1 is an offset, 2 an object stream and an index in it
+    typedef struct {
+      unsigned char type;
+      unsigned long long field2;
+      unsigned long field3;
+    } xref_entry_t;
+
+    const char* data = NULL;
+    size_t size = 0;
+    PDFParser parser;
+    std::vector<object_t> objects;
+    std::unordered_map<ObjectIDType, size_t> objectBySource;
+    std::deque<size_t> pending;
+
+    IByteWriterWithPosition* output = NULL;
+    bool failed = false;
+    std::vector<xref_entry_t> xref;
+
+    void write(const std::string& text) {
+      if(!failed && output->Write((const IOBasicTypes::Byte*)text.data(), text.size()) != text.size()) {
+        failed = true;
+      }
+    }
+
+    void write(const char* bytes, size_t length) {
+      if(!failed && output->Write((const IOBasicTypes::Byte*)bytes, length) != length) {
+        failed = true;
+      }
+    }
+
+    void visit(ObjectIDType source) {
+      if(objectBySource.find(source) != objectBySource.end()) {
+        return;
+      }
+      objectBySource[source] = objects.size();
+      objects.push_back({ source, RefCountPtr<PDFObject>(), 0 });
+      pending.push_back(objects.size() - 1);
+    }
+
+    /**
+     * visit every object a direct object points at. a stream Length is written as a number, so it's not followed
+     */
+    void collect(PDFObject* object) {
+      switch(object->GetType()) {
+        case PDFObject::ePDFObjectIndirectObjectReference: {
+          visit(((PDFIndirectObjectReference*)object)->mObjectID);
+          break;
+        }
+        case PDFObject::ePDFObjectArray: {
+          SingleValueContainerIterator<PDFObjectVector> it = ((PDFArray*)object)->GetIterator();
+          while(it.MoveNext()) {
+            collect(it.GetItem());
+          }
+          break;
+        }
+        case PDFObject::ePDFObjectDictionary: {
+          MapIterator<PDFNameToPDFObjectMap> it = ((PDFDictionary*)object)->GetIterator();
+          while(it.MoveNext()) {
+            collect(it.GetValue());
+          }
+          break;
+        }
+        case PDFObject::ePDFObjectStream: {
+          PDFObjectCastPtr<PDFDictionary> streamDictionary(((PDFStreamInput*)object)->QueryStreamDictionary());
+          MapIterator<PDFNameToPDFObjectMap> it = streamDictionary->GetIterator();
+          while(it.MoveNext()) {
+            if(it.GetKey()->GetValue() != "Length") {
+              collect(it.GetValue());
+            }
+          }
+          break;
+        }
+        default: {
+          break;
+        }
+      }
+    }
+
+    /**
+     * walk the objects from the trailer, then number the ones that are there. references to objects that aren't
+     * become null
+     */
+    void collectObjects(PDFDictionary* trailer) {
+      RefCountPtr<PDFObject> root(trailer->QueryDirectObject("Root"));
+      RefCountPtr<PDFObject> info(trailer->QueryDirectObject("Info"));
+      if(root != NULL) {
+        collect(root.GetPtr());
+      }
+      if(info != NULL) {
+        collect(info.GetPtr());
+      }
+
+      while(!pending.empty()) {
+        size_t index = pending.front();
+        pending.pop_front();
+
+        RefCountPtr<PDFObject> object(parser.ParseNewObject(objects[index].source));
+        if(object != NULL) {
+          collect(object.GetPtr());
+        }
+        objects[index].object = object;
+      }
+
+      ObjectIDType id = 0;
+      for(object_t& object : objects) {
+        if(object.object != NULL) {
+          object.id = ++id;
+        }
+      }
+    }
+
+    /**
+     * write a direct object as pdf syntax, with its references pointing at the new object numbers
+     */
+    void serializeObject(PDFObject* object, std::string& out) {
+      pdf_form_serialize::serializeObject(object, out, [this](const PDFIndirectObjectReference* reference, std::string& written) {
+        auto found = objectBySource.find(reference->mObjectID);
+        if(found == objectBySource.end() || objects[found->second].id == 0) {
+          written += "null";
+        } else {
+          written += std::to_string(objects[found->second].id) + " 0 R";
+        }
+      });
+    }
+
+    std::string deflate(const std::string& content) {
+      OutputStringBufferStream buffer;
+      {
+        // the encoder flushes what it still holds when it goes
+        OutputFlateEncodeStream flate(&buffer);
+        flate.Write((const IOBasicTypes::Byte*)content.data(), content.size());
+      }
+      return buffer.ToString();
+    }
+
+    /**
+     * copy a stream object, still encoded. its Length is written as a number
+     */
+    EStatusCode writeStream(const object_t& object) {
+      PDFStreamInput* stream = (PDFStreamInput*)object.object.GetPtr();
+      PDFObjectCastPtr<PDFDictionary> streamDictionary(stream->QueryStreamDictionary());
+
+      RefCountPtr<PDFObject> lengthObject(parser.QueryDictionaryObject(streamDictionary.GetPtr(), "Length"));
+      long long length = lengthObject != NULL ? ParsedPrimitiveHelper(lengthObject.GetPtr()).GetAsInteger() : -1;
+      long long start = stream->GetStreamContentStart();
+      if(length < 0 || start < 0 || (size_t)(start + length) > size) {
+        return eFailure;
+      }
+
+      std::string header = std::to_string(object.id) + " 0 obj\n<<";
+      MapIterator<PDFNameToPDFObjectMap> it = streamDictionary->GetIterator();
+      while(it.MoveNext()) {
+        if(it.GetKey()->GetValue() == "Length") {
+          continue;
+        }
+        header += ' ';
+        pdf_form_serialize::serializeName(it.GetKey()->GetValue(), header);
+        header += ' ';
+        serializeObject(it.GetValue(), header);
+      }
+      header += " /Length " + std::to_string(length) + " >>\nstream\n";
+
+      xref[object.id] = { 1, (unsigned long long)output->GetCurrentPosition(), 0 };
+      write(header);
+      write(data + start, length);
+      write("\nendstream\nendobj\n");
+      return eSuccess;
+    }
+
+    /**
+     * pack objects into an object stream of their own
+     */
+    void writeObjectStream(ObjectIDType id, const std::vector<const object_t*>& members) {
+      std::string offsets;
+      std::string body;
+      for(size_t i = 0; i < members.size(); i++) {
+        offsets += std::to_string(members[i]->id) + " " + std::to_string(body.size()) + " ";
+        serializeObject(members[i]->object.GetPtr(), body);
+        body += '\n';
+        xref[members[i]->id] = { 2, id, (unsigned long)i };
+      }
+
+      std::string compressed = deflate(offsets + "\n" + body);
+      xref[id] = { 1, (unsigned long long)output->GetCurrentPosition(), 0 };
+      write(std::to_string(id) + " 0 obj\n<< /Type /ObjStm /N " + std::to_string(members.size()) + " /First " + std::to_string(offsets.size() + 1) +
+        " /Filter /FlateDecode /Length " + std::to_string(compressed.size()) + " >>\nstream\n");
+      write(compressed);
+      write("\nendstream\nendobj\n");
+    }
+
+    /**
+     * the cross reference stream, which takes the place of both the xref table and the trailer
+     */
+    void writeXrefStream(ObjectIDType id, PDFDictionary* trailer) {
+      unsigned long long position = output->GetCurrentPosition();
+      xref[id] = { 1, position, 0 };
+
+      // as many bytes as the largest offset or object stream number takes
+      unsigned long long largest = std::max<unsigned long long>(position, id);
+      int width = 1;
+      while(width < 8 && (largest >> (8 * width)) != 0) {
+        width++;
+      }
+
+      std::string entries;
+      entries.reserve(xref.size() * (width + 3));
+      for(size_t i = 0; i < xref.size(); i++) {
+        // object 0 heads the free list, with the 65535 generation
+        xref_entry_t entry = i == 0 ? xref_entry_t{ 0, 0, 65535 } : xref[i];
+        entries += (char)entry.type;
+        for(int byte = width - 1; byte >= 0; byte--) {
+          entries += (char)((entry.field2 >> (8 * byte)) & 0xff);
+        }
+        entries += (char)((entry.field3 >> 8) & 0xff);
+        entries += (char)(entry.field3 & 0xff);
+      }
+
+      std::string dictionary = std::to_string(id) + " 0 obj\n<< /Type /XRef /Size " + std::to_string(xref.size()) +
+        " /W [ 1 " + std::to_string(width) + " 2 ]";
+      const char* keys[] = { "Root", "Info", "ID" };
+      for(const char* key : keys) {
+        RefCountPtr<PDFObject> value(trailer->QueryDirectObject(key));
+        if(value != NULL) {
+          dictionary += ' ';
+          pdf_form_serialize::serializeName(key, dictionary);
+          dictionary += ' ';
+          serializeObject(value.GetPtr(), dictionary);
+        }
+      }
+
+      std::string compressed = deflate(entries);
+      write(dictionary + " /Filter /FlateDecode /Length " + std::to_string(compressed.size()) + " >>\nstream\n");
+      write(compressed);
+      write("\nendstream\nendobj\nstartxref\n" + std::to_string(position) + "\n%%EOF\n");
+    }
+
+  public:
+    pdf_form_rewrite() {}
+    pdf_form_rewrite(const pdf_form_rewrite&) = delete;
+    pdf_form_rewrite& operator=(const pdf_form_rewrite&) = delete;
+
+    /**
+     * rewrite the pdf in data into output. one rewrite per instance
+     */
+    EStatusCode rewrite(const char* data, size_t size, IByteWriterWithPosition* output) {
+      this->data = data;
+      this->size = size;
+      this->output = output;
+
+      InputByteArrayStream source((IOBasicTypes::Byte*)data, size);
+      if(parser.StartPDFParsing(&source) != eSuccess) {
+        return eFailure;
+      }
+
+      PDFDictionary* trailer = parser.GetTrailer();
+      if(trailer == NULL || !trailer->Exists("Root") || trailer->Exists("Encrypt")) {
+        return eFailure;
+      }
+
+      collectObjects(trailer);
+
+      // the objects keep their numbers, then come the object streams, then the cross reference stream
+      ObjectIDType lastId = 0;
+      std::vector<const object_t*> packed;
+      for(const object_t& object : objects) {
+        if(object.id == 0) {
+          continue;
+        }
+        lastId = object.id;
+        if(object.object.GetPtr()->GetType() != PDFObject::ePDFObjectStream) {
+          packed.push_back(&object);
+        }
+      }
+      ObjectIDType streamCount = (packed.size() + OBJECTS_PER_STREAM - 1) / OBJECTS_PER_STREAM;
+      ObjectIDType xrefId = lastId + streamCount + 1;
+      xref.assign(xrefId + 1, { 0, 0, 0 });
+
+      char header[32];
+      double level = parser.GetPDFLevel();
+      snprintf(header, sizeof(header), "%%PDF-%.1f\n%%", level > 1.5 ? level : 1.5);
+      write(header);
+      write("\xE2\xE3\xCF\xD3\n");
+
+      for(const object_t& object : objects) {
+        if(object.id != 0 && object.object.GetPtr()->GetType() == PDFObject::ePDFObjectStream) {
+          if(writeStream(object) != eSuccess) {
+            return eFailure;
+          }
+        }
+      }
+
+      for(ObjectIDType i = 0; i < streamCount; i++) {
+        std::vector<const object_t*> members(
+          packed.begin() + i * OBJECTS_PER_STREAM,
+          packed.begin() + std::min<size_t>((i + 1) * OBJECTS_PER_STREAM, packed.size())
+        );
+        writeObjectStream(lastId + 1 + i, members);
+      }
+
+      writeXrefStream(xrefId, trailer);
+      return failed ? eFailure : eSuccess;
+    }
+};
+
+#endif //__PDF_FORM_REWRITE_H__
@@ -0,0 +1,168 @@
+#ifndef __PDF_FORM_SERIALIZE_H__
+#define __PDF_FORM_SERIALIZE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <functional>
+
+#include "PDFObject.h"
+#include "PDFDictionary.h"
+#include "PDFArray.h"
+#include "PDFName.h"
+#include "PDFInteger.h"
+#include "PDFReal.h"
+#include "PDFBoolean.h"
+#include "PDFLiteralString.h"
+#include "PDFHexString.h"
+#include "PDFIndirectObjectReference.h"
+
+/**
+ * parsed objects written back out as pdf syntax, for the fill (which keeps references as they are) and the rewrite
+ * (which numbers them anew). how a reference is written is up to the caller, everything else is written the one way
+ */
+class pdf_form_serialize {
+  public:
+    // writes a reference into out. the default keeps its object number and version
+    typedef std::function<void(const PDFIndirectObjectReference* reference, std::string& out)> reference_hook_t;
+
+    /**
+     * the shortest fixed point form that reads back as the very same double. pdf has no exponents, so very large and
+     * very small numbers come out long, as they have to
+     */
+    static std::string formatNumber(double value) {
+      if(!isfinite(value)) {
+        return "0";
+      }
+
+      char buffer[512];
+      if(fabs(value) < 1e15 && value == (double)(long long)value) {
+        snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+        return buffer;
+      }
+
+      // 5e-324, the smallest there is, takes 324 places after the point
+      for(int precision = 0; precision <= 330; precision++) {
+        snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+        if(strtod(buffer, NULL) == value) {
+          break;
+        }
+      }
+
+      std::string number = buffer;
+      if(number.find('.') != std::string::npos) {
+        number.erase(number.find_last_not_of('0') + 1);
+        if(number.back() == '.') {
+          number.pop_back();
+        }
+      }
+      return number;
+    }
+
+    static void serializeName(const std::string& name, std::string& out) {
+      static const char hex[] = "0123456789ABCDEF";
+      out += '/';
+      for(unsigned char c : name) {
+        if(c < 0x21 || c > 0x7e || strchr("#()<>[]{}/%", c) != NULL) {
+          out += '#';
+          out += hex[c >> 4];
+          out += hex[c & 0xf];
+        } else {
+          out += c;
+        }
+      }
+    }
+
+    static void appendLiteralString(const std::string& value, std::string& out) {
+      out += '(';
+      for(char c : value) {
+        if(c == '(' || c == ')' || c == '\\') {
+          out += '\\';
+        } else if(c == '\r') {
+          out += "\\r";
+          continue;
+        }
+        out += c;
+      }
+      out += ')';
+    }
+
+    /**
+     * write a direct object as pdf syntax, its references through reference. streams can't be direct objects, so
+     * they never show up here
+     */
+    static void serializeObject(PDFObject* object, std::string& out, const reference_hook_t& reference = reference_hook_t()) {
+      static const char hex[] = "0123456789ABCDEF";
+
+      switch(object->GetType()) {
+        case PDFObject::ePDFObjectBoolean: {
+          out += ((PDFBoolean*)object)->GetValue() ? "true" : "false";
+          break;
+        }
+        case PDFObject::ePDFObjectLiteralString: {
+          appendLiteralString(((PDFLiteralString*)object)->GetValue(), out);
+          break;
+        }
+        case PDFObject::ePDFObjectHexString: {
+          out += '<';
+          for(unsigned char c : ((PDFHexString*)object)->GetValue()) {
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+          }
+          out += '>';
+          break;
+        }
+        case PDFObject::ePDFObjectName: {
+          serializeName(((PDFName*)object)->GetValue(), out);
+          break;
+        }
+        case PDFObject::ePDFObjectInteger: {
+          out += std::to_string(((PDFInteger*)object)->GetValue());
+          break;
+        }
+        case PDFObject::ePDFObjectReal: {
+          out += formatNumber(((PDFReal*)object)->GetValue());
+          break;
+        }
+        case PDFObject::ePDFObjectArray: {
+          out += '[';
+          SingleValueContainerIterator<PDFObjectVector> it = ((PDFArray*)object)->GetIterator();
+          while(it.MoveNext()) {
+            out += ' ';
+            serializeObject(it.GetItem(), out, reference);
+          }
+          out += " ]";
+          break;
+        }
+        case PDFObject::ePDFObjectDictionary: {
+          out += "<<";
+          MapIterator<PDFNameToPDFObjectMap> it = ((PDFDictionary*)object)->GetIterator();
+          while(it.MoveNext()) {
+            out += ' ';
+            serializeName(it.GetKey()->GetValue(), out);
+            out += ' ';
+            serializeObject(it.GetValue(), out, reference);
+          }
+          out += " >>";
+          break;
+        }
+        case PDFObject::ePDFObjectIndirectObjectReference: {
+          PDFIndirectObjectReference* indirect = (PDFIndirectObjectReference*)object;
+          if(reference) {
+            reference(indirect, out);
+          } else {
+            out += std::to_string(indirect->mObjectID) + " " + std::to_string(indirect->mVersion) + " R";
+          }
+          break;
+        }
+        default: {
+          out += "null";
+          break;
+        }
+      }
+    }
+};
+
+#endif //__PDF_FORM_SERIALIZE_H__
@@ -0,0 +1,152 @@
+#ifndef __PDF_FORM_SINK_H__
+#define __PDF_FORM_SINK_H__
+
+#include <errno.h>
+#include <unistd.h>
+#include <string>
+#include <functional>
+
+#include "IByteWriterWithPosition.h"
+
+/**
+ * places to write a filled pdf to other than a file. hand any of them to pdf_form_fill::fillTemplate.
+ * the position is the count of bytes written so far, which is all PDFWriter needs it for (xref offsets)
+ */
+
+/**
+ * a growable in memory buffer. the pdf ends up in buffer
+ */
+class pdf_form_buffer_sink : public IByteWriterWithPosition {
+  public:
+    std::string buffer;
+
+    pdf_form_buffer_sink(size_t expectedSize = 0) {
+      buffer.reserve(expectedSize);
+    }
+
+    IOBasicTypes::LongBufferSizeType Write(const IOBasicTypes::Byte* inBuffer, IOBasicTypes::LongBufferSizeType inSize) {
+      buffer.append((const char*)inBuffer, inSize);
+      return inSize;
+    }
+
+    IOBasicTypes::LongFilePositionType GetCurrentPosition() {
+      return buffer.size();
+    }
+};
+
+/**
+ * collects writes into chunks before passing them on, so a socket or pipe doesn't see a syscall per pdf token.
+ * call flush() once the fill is done, it tells whether everything made it through
+ */
+class pdf_form_chunked_sink : public IByteWriterWithPosition {
+  private:
+    std::string chunk;
+    size_t chunkSize;
+    IOBasicTypes::LongFilePositionType position = 0;
+    bool failed = false;
+
+  protected:
+    // pass a chunk on. false if it didn't all go through
+    virtual bool writeChunk(const char* data, size_t size) = 0;
+
+  public:
+    pdf_form_chunked_sink(size_t chunkSize = 65536) {
+      this->chunkSize = chunkSize;
+      chunk.reserve(chunkSize);
+    }
+
+    virtual ~pdf_form_chunked_sink() {}
+
+    IOBasicTypes::LongBufferSizeType Write(const IOBasicTypes::Byte* inBuffer, IOBasicTypes::LongBufferSizeType inSize) {
+      position += inSize;
+      if(failed) {
+        return inSize;
+      }
+
+      if(chunk.size() + inSize > chunkSize) {
+        flush();
+        if(inSize >= chunkSize) {
+          // big enough to go as is
+          failed = failed || !writeChunk((const char*)inBuffer, inSize);
+          return inSize;
+        }
+      }
+      chunk.append((const char*)inBuffer, inSize);
+      return inSize;
+    }
+
+    IOBasicTypes::LongFilePositionType GetCurrentPosition() {
+      return position;
+    }
+
+    /**
+     * write out whatever is still waiting. false if anything written so far failed
+     */
+    bool flush() {
+      if(!failed && !chunk.empty()) {
+        failed = !writeChunk(chunk.data(), chunk.size());
+      }
+      chunk.clear();
+      return !failed;
+    }
+};
+
+/**
+ * a file descriptor, like a socket or a pipe. the descriptor stays open, it's the caller's
+ */
+class pdf_form_fd_sink : public pdf_form_chunked_sink {
+  private:
+    int fd;
+
+  protected:
+    bool writeChunk(const char* data, size_t size) {
+      while(size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          return false;
+        }
+        data += written;
+        size -= written;
+      }
+      return true;
+    }
+
+  public:
+    pdf_form_fd_sink(int fd, size_t chunkSize = 65536) : pdf_form_chunked_sink(chunkSize) {
+      this->fd = fd;
+    }
+
+    ~pdf_form_fd_sink() {
+      flush();
+    }
+};
+
+/**
+ * a callback, handed the pdf chunk by chunk. return false from it to drop the rest
+ */
+class pdf_form_callback_sink : public pdf_form_chunked_sink {
+  public:
+    typedef std::function<bool(const char* data, size_t size)> callback_t;
+
+  private:
+    callback_t callback;
+
+  protected:
+    bool writeChunk(const char* data, size_t size) {
+      return callback(data, size);
+    }
+
+  public:
+    pdf_form_callback_sink(callback_t callback, size_t chunkSize = 65536) : pdf_form_chunked_sink(chunkSize) {
+      this->callback = callback;
+    }
+
+    ~pdf_form_callback_sink() {
+      flush();
+    }
+};
+
+#endif //__PDF_FORM_SINK_H__
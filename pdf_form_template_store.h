@@ -0,0 +1,149 @@
+#ifndef __PDF_FORM_TEMPLATE_STORE_H__
+#define __PDF_FORM_TEMPLATE_STORE_H__
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <map>
+#include <memory>
+
+#include "pdf_form_fill.h"
+
+/**
+ * the templates of a fill host, memory mapped read only and parsed once at startup.
+ * the pdf bytes are never copied: every fill thread reads the same mapping, and so do workers forked after the store
+ * is loaded, so the page cache holds the one copy of each template no matter how many workers there are.
+ * the parsed form models are built before forking too, which leaves them shared (copy on write) as well.
+ * once loaded the store is read only, get() is safe from any thread
+ */
+class pdf_form_template_store {
+  public:
+    typedef struct {
+      std::string name;
+      std::string error;
+    } load_error_t;
+
+  private:
+    typedef struct mapping_t {
+      void* data = MAP_FAILED;
+      size_t size = 0;
+
+      ~mapping_t() {
+        if(data != MAP_FAILED) {
+          munmap(data, size);
+        }
+      }
+    } mapping_t;
+
+    // the form reads the mapping, so the mapping has to outlive it. members are destroyed last to first
+    typedef struct {
+      mapping_t mapping;
+      pdf_form_fill::form_template_t form;
+    } mapped_template_t;
+
+    std::map<std::string, std::unique_ptr<mapped_template_t>> templates;
+    std::vector<load_error_t> errors;
+    std::string fontDirectory;
+
+    bool fail(const std::string& name, const std::string& error) {
+      errors.push_back({ name, error });
+      return false;
+    }
+
+  public:
+    pdf_form_template_store() {}
+    pdf_form_template_store(const pdf_form_template_store&) = delete;
+    pdf_form_template_store& operator=(const pdf_form_template_store&) = delete;
+
+    /**
+     * see pdf_form_fill::setFontDirectory. set it before adding templates
+     */
+    void setFontDirectory(const std::string& path) {
+      fontDirectory = path;
+    }
+
+    /**
+     * map a template file and parse it. name is what get() finds it by. a template that doesn't map or parse is left
+     * out, with the reason in getErrors()
+     */
+    bool add(const std::string& name, const std::string& path) {
+      std::unique_ptr<mapped_template_t> entry(new mapped_template_t());
+
+      int fd = open(path.c_str(), O_RDONLY);
+      if(fd < 0) {
+        return fail(name, "failed to open " + path);
+      }
+
+      struct stat info;
+      if(fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return fail(name, "failed to stat " + path);
+      }
+
+      entry->mapping.size = info.st_size;
+      entry->mapping.data = mmap(NULL, entry->mapping.size, PROT_READ, MAP_SHARED, fd, 0);
+      // the mapping keeps the file, the descriptor isn't needed anymore
+      close(fd);
+      if(entry->mapping.data == MAP_FAILED) {
+        return fail(name, "failed to map " + path);
+      }
+
+      try {
+        pdf_form_fill pff;
+        pff.setFontDirectory(fontDirectory);
+        if(pff.loadTemplate(entry->form, (const char*)entry->mapping.data, entry->mapping.size) != eSuccess) {
+          return fail(name, "failed to parse " + path);
+        }
+      } catch(const char* error) {
+        return fail(name, std::string(error) + " in " + path);
+      }
+
+      templates[name] = std::move(entry);
+      return true;
+    }
+
+    /**
+     * add every .pdf file of a directory, by its file name. returns the number of templates added
+     */
+    size_t addDirectory(const std::string& directory) {
+      size_t added = 0;
+      DIR* dir = opendir(directory.c_str());
+      if(dir == NULL) {
+        fail(directory, "failed to open directory " + directory);
+        return 0;
+      }
+
+      struct dirent* item;
+      while((item = readdir(dir)) != NULL) {
+        std::string name = item->d_name;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".pdf") == 0) {
+          if(add(name, directory + "/" + name)) {
+            added++;
+          }
+        }
+      }
+      closedir(dir);
+      return added;
+    }
+
+    /**
+     * a loaded template, NULL if there's none by that name
+     */
+    const pdf_form_fill::form_template_t* get(const std::string& name) const {
+      auto found = templates.find(name);
+      return found == templates.end() ? NULL : &found->second->form;
+    }
+
+    size_t size() const {
+      return templates.size();
+    }
+
+    const std::vector<load_error_t>& getErrors() const {
+      return errors;
+    }
+};
+
+#endif //__PDF_FORM_TEMPLATE_STORE_H__
@@ -0,0 +1,130 @@
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+
+#include "pdf_form_fill.h"
+#include "pdf_form_template_store.h"
+#include "pdf_form_sink.h"
+#include "pdf_form_bench_forms.h"
+
+/**
+ * template store benchmark. writes a few hundred synthetic templates of different sizes, loads them all, and reports
+ * the startup time and memory of the loading process and of workers forked off it, each filling a bunch of them.
+ * run it as "mmap" (the template store) and as "copy" (every template read into the heap with loadTemplate) to compare
+ */
+
+typedef struct {
+  long rss;
+  long pss;
+  long privateBytes;
+} memory_t;
+
+// in kB, out of /proc/self/smaps_rollup
+memory_t readMemory() {
+  memory_t memory = { 0, 0, 0 };
+  FILE* smaps = fopen("/proc/self/smaps_rollup", "r");
+  if(smaps == NULL) {
+    return memory;
+  }
+
+  char line[256];
+  long value;
+  while(fgets(line, sizeof(line), smaps) != NULL) {
+    if(sscanf(line, "Rss: %ld", &value) == 1) {
+      memory.rss = value;
+    } else if(sscanf(line, "Pss: %ld", &value) == 1) {
+      memory.pss = value;
+    } else if(sscanf(line, "Private_Clean: %ld", &value) == 1 || sscanf(line, "Private_Dirty: %ld", &value) == 1) {
+      memory.privateBytes += value;
+    }
+  }
+  fclose(smaps);
+  return memory;
+}
+
+void printMemory(const char* label, const memory_t& memory) {
+  printf("%-24s rss=%ldkB pss=%ldkB private=%ldkB\n", label, memory.rss, memory.pss, memory.privateBytes);
+}
+
+int main(int argc, char** argv) {
+  size_t templateCount = argc > 1 ? strtoul(argv[1], NULL, 10) : 300;
+  std::string mode = argc > 2 ? argv[2] : "mmap";
+  size_t workerCount = argc > 3 ? strtoul(argv[3], NULL, 10) : 4;
+  const size_t fillsPerWorker = 50;
+
+  std::string directory = "pdf_form_template_store_bench";
+  mkdir(directory.c_str(), 0755);
+
+  std::vector<std::string> names;
+  size_t totalBytes = 0;
+  for(size_t i = 0; i < templateCount; i++) {
+    std::string name = "template" + std::to_string(i) + ".pdf";
+    size_t fieldCount = 50 + (i * 37) % 450;
+    if(!writeSyntheticForm(directory + "/" + name, fieldCount)) {
+      printf("failed to write %s\n", name.c_str());
+      return 1;
+    }
+    struct stat info;
+    if(stat((directory + "/" + name).c_str(), &info) == 0) {
+      totalBytes += info.st_size;
+    }
+    names.push_back(name);
+  }
+  printf("templates=%zu bytes=%zu mode=%s\n", templateCount, totalBytes, mode.c_str());
+
+  memory_t before = readMemory();
+  auto start = std::chrono::steady_clock::now();
+
+  pdf_form_template_store store;
+  std::vector<std::unique_ptr<pdf_form_fill::form_template_t>> copies;
+  if(mode == "copy") {
+    pdf_form_fill pff;
+    for(const std::string& name : names) {
+      copies.push_back(std::unique_ptr<pdf_form_fill::form_template_t>(new pdf_form_fill::form_template_t()));
+      if(pff.loadTemplate(*copies.back(), directory + "/" + name) != eSuccess) {
+        printf("failed to load %s\n", name.c_str());
+        return 1;
+      }
+    }
+  } else {
+    store.addDirectory(directory);
+    for(const pdf_form_template_store::load_error_t& error : store.getErrors()) {
+      printf("%s: %s\n", error.name.c_str(), error.error.c_str());
+    }
+  }
+
+  double startup = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  printf("startup=%.1fms\n", startup);
+  printMemory("before load", before);
+  printMemory("after load", readMemory());
+  fflush(stdout);
+
+  for(size_t worker = 0; worker < workerCount; worker++) {
+    pid_t pid = fork();
+    if(pid != 0) {
+      continue;
+    }
+
+    // a worker. fill random templates, into memory so only the templates and the fill count
+    std::mt19937 random(worker);
+    pdf_form_fill pff;
+    std::map<std::string, pdf_form_fill::pdf_value_t> data = { { "field0", "value" }, { "field1", "value" } };
+    for(size_t i = 0; i < fillsPerWorker; i++) {
+      size_t index = random() % names.size();
+      const pdf_form_fill::form_template_t* form = mode == "copy" ? copies[index].get() : store.get(names[index]);
+      pdf_form_buffer_sink sink;
+      pff.fillTemplate(*form, data, &sink);
+    }
+
+    std::string label = "worker " + std::to_string(worker);
+    printMemory(label.c_str(), readMemory());
+    fflush(stdout);
+    _exit(0);
+  }
+
+  for(size_t worker = 0; worker < workerCount; worker++) {
+    wait(NULL);
+  }
+  return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef __PDF_FORM_TIMER_H__
+#define __PDF_FORM_TIMER_H__
+
+#include <chrono>
+
+/**
+ * timers for the hot paths of a fill, the ones that run per field or per appearance. they only exist when built with
+ * PDF_FORM_FILL_TIMERS defined, otherwise PDF_FORM_TIMER is nothing at all and the totals it would add to stay 0.
+ * the per fill phases are timed either way, that's a handful of clock reads a document
+ */
+class pdf_form_scoped_timer {
+  private:
+    double& total;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    // adds the microseconds till the end of the scope to total
+    pdf_form_scoped_timer(double& total) : total(total), start(std::chrono::steady_clock::now()) {}
+
+    ~pdf_form_scoped_timer() {
+      total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    pdf_form_scoped_timer(const pdf_form_scoped_timer&) = delete;
+    pdf_form_scoped_timer& operator=(const pdf_form_scoped_timer&) = delete;
+};
+
+#ifdef PDF_FORM_FILL_TIMERS
+#define PDF_FORM_TIMER(total) pdf_form_scoped_timer pdfFormTimer(total)
+#else
+#define PDF_FORM_TIMER(total)
+#endif
+
+#endif //__PDF_FORM_TIMER_H__